@@ -0,0 +1,62 @@
+#include "../set_symmetry.hpp"
+
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/**
+ *  Times the file difference of a source and a destination list, like the cloner builds it.
+ *  Every tenth path of the source is missing in the destination.
+ *
+ *  Usage: set_symmetry_benchmark [path count...], defaults to 10k, 100k, 1M and 10M paths.
+ */
+//#####################################################################################################################
+namespace
+{
+    using PathSet = std::set <std::string>;
+    using Extractor = SymmetricDifferenceExtractor <PathSet::iterator>;
+
+    void fill(std::size_t count, PathSet& source, PathSet& destination)
+    {
+        for (std::size_t i = 0; i != count; ++i)
+        {
+            auto path = "/dir" + std::to_string(i % 997) + "/file" + std::to_string(i) + ".dat";
+            if (i % 10 != 0)
+                destination.insert(path);
+            source.insert(std::move(path));
+        }
+    }
+}
+//#####################################################################################################################
+int main(int argc, char** argv)
+{
+    std::vector <std::size_t> counts;
+    for (int i = 1; i < argc; ++i)
+        counts.push_back(std::strtoull(argv[i], nullptr, 10));
+    if (counts.empty())
+        counts = {10'000, 100'000, 1'000'000, 10'000'000};
+
+    std::cout << std::setw(10) << "paths" << std::setw(12) << "seconds" << std::setw(12) << "missing" << "\n";
+    for (auto count : counts)
+    {
+        PathSet source;
+        PathSet destination;
+        fill(count, source, destination);
+
+        // in steps of the budget the cloner uses per pulse.
+        auto start = std::chrono::steady_clock::now();
+        Extractor extractor{&source, &destination};
+        while (!extractor.workLeftOnly(100'000))
+        {
+        }
+        std::chrono::duration <double> elapsed = std::chrono::steady_clock::now() - start;
+
+        std::cout << std::setw(10) << count
+                  << std::setw(12) << std::fixed << std::setprecision(3) << elapsed.count()
+                  << std::setw(12) << extractor.leftSize() << "\n";
+    }
+    return 0;
+}
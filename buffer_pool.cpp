@@ -0,0 +1,222 @@
+#include "buffer_pool.hpp"
+
+#ifdef _WIN32
+#   include <malloc.h>
+#else
+#   include <stdlib.h>
+#endif
+
+#include <algorithm>
+
+namespace FileSpreader
+{
+//#####################################################################################################################
+    namespace
+    {
+        char* allocateAligned(uint64_t size)
+        {
+#ifdef _WIN32
+            return static_cast <char*> (::_aligned_malloc(size, BufferPool::alignment));
+#else
+            void* memory = nullptr;
+            if (::posix_memalign(&memory, BufferPool::alignment, size) != 0)
+                return nullptr;
+            return static_cast <char*> (memory);
+#endif
+        }
+        void freeAligned(char* memory)
+        {
+#ifdef _WIN32
+            ::_aligned_free(memory);
+#else
+            ::free(memory);
+#endif
+        }
+        uint64_t roundUpToPowerOfTwo(uint64_t size)
+        {
+            uint64_t result = BufferPool::alignment;
+            while (result < size)
+                result <<= 1;
+            return result;
+        }
+    }
+//#####################################################################################################################
+    constexpr uint64_t BufferPool::alignment;
+//#####################################################################################################################
+    BufferPool::Buffer::Buffer()
+        : pool_()
+        , data_(nullptr)
+        , capacity_(0)
+        , size_(0)
+    {
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    BufferPool::Buffer::Buffer(std::shared_ptr <BufferPool> pool, char* data, uint64_t capacity, uint64_t size)
+        : pool_(std::move(pool))
+        , data_(data)
+        , capacity_(capacity)
+        , size_(size)
+    {
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    BufferPool::Buffer::~Buffer()
+    {
+        release();
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    BufferPool::Buffer::Buffer(Buffer&& other)
+        : pool_(std::move(other.pool_))
+        , data_(other.data_)
+        , capacity_(other.capacity_)
+        , size_(other.size_)
+    {
+        other.data_ = nullptr;
+        other.capacity_ = 0;
+        other.size_ = 0;
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    BufferPool::Buffer& BufferPool::Buffer::operator=(Buffer&& other)
+    {
+        if (this != &other)
+        {
+            release();
+            pool_ = std::move(other.pool_);
+            data_ = other.data_;
+            capacity_ = other.capacity_;
+            size_ = other.size_;
+            other.data_ = nullptr;
+            other.capacity_ = 0;
+            other.size_ = 0;
+        }
+        return *this;
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    BufferPool::Buffer::operator bool() const
+    {
+        return data_ != nullptr;
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    char* BufferPool::Buffer::data() const
+    {
+        return data_;
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    uint64_t BufferPool::Buffer::size() const
+    {
+        return size_;
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    void BufferPool::Buffer::release()
+    {
+        if (data_ != nullptr)
+            pool_->giveBack(data_, capacity_);
+
+        pool_.reset();
+        data_ = nullptr;
+        capacity_ = 0;
+        size_ = 0;
+    }
+//#####################################################################################################################
+    BufferPool::BufferPool(uint64_t limit)
+        : lock_()
+        , idle_()
+        , limit_(std::max(limit, alignment))
+        , maxBufferSize_(alignment)
+        , allocated_(0)
+        , inUse_(0)
+    {
+        while (maxBufferSize_ * 2 <= limit_ / 8)
+            maxBufferSize_ *= 2;
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    BufferPool::~BufferPool()
+    {
+        // handed out buffers keep the pool alive, so only idle ones are left.
+        while (freeIdleBuffer())
+        {
+        }
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    BufferPool::Buffer BufferPool::acquire(uint64_t size)
+    {
+        if (size == 0)
+            return {};
+
+        size = std::min(size, maxBufferSize_);
+        auto const capacity = roundUpToPowerOfTwo(size);
+
+        std::lock_guard <std::mutex> guard(lock_);
+
+        auto& idle = idle_[capacity];
+        if (!idle.empty())
+        {
+            auto* data = idle.back();
+            idle.pop_back();
+            inUse_ += capacity;
+            return Buffer(shared_from_this(), data, capacity, size);
+        }
+
+        // idle buffers of other sizes are worth less than this request.
+        while (allocated_ + capacity > limit_ && freeIdleBuffer())
+        {
+        }
+        if (allocated_ + capacity > limit_)
+            return {};
+
+        auto* data = allocateAligned(capacity);
+        if (data == nullptr)
+            return {};
+
+        allocated_ += capacity;
+        inUse_ += capacity;
+        return Buffer(shared_from_this(), data, capacity, size);
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    void BufferPool::giveBack(char* data, uint64_t capacity)
+    {
+        std::lock_guard <std::mutex> guard(lock_);
+        idle_[capacity].push_back(data);
+        inUse_ -= capacity;
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    bool BufferPool::freeIdleBuffer()
+    {
+        /** do not lock here, lock one layer up **/
+
+        // the biggest first, that makes room the quickest.
+        for (auto i = idle_.rbegin(); i != idle_.rend(); ++i)
+        {
+            if (i->second.empty())
+                continue;
+
+            freeAligned(i->second.back());
+            i->second.pop_back();
+            allocated_ -= i->first;
+            return true;
+        }
+        return false;
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    uint64_t BufferPool::getMaxBufferSize() const
+    {
+        return maxBufferSize_;
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    uint64_t BufferPool::getLimit() const
+    {
+        return limit_;
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    uint64_t BufferPool::getAllocated() const
+    {
+        std::lock_guard <std::mutex> guard(lock_);
+        return allocated_;
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    uint64_t BufferPool::getInUse() const
+    {
+        std::lock_guard <std::mutex> guard(lock_);
+        return inUse_;
+    }
+//#####################################################################################################################
+}
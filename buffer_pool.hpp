@@ -0,0 +1,112 @@
+#pragma once
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <cstdint>
+
+namespace FileSpreader
+{
+    /**
+     *  A bounded pool of page aligned copy buffers, shared by all copy processes.
+     *  Buffers are handed out in power of two sizes and kept for reuse after they are given back,
+     *  so copying many files does not allocate (and zero) a new buffer for every one of them.
+     *  The memory of all buffers, in use or idle, never exceeds the limit. Idle buffers are freed to make room.
+     *  Must be created with std::make_shared, handed out buffers keep the pool alive.
+     */
+    class BufferPool : public std::enable_shared_from_this <BufferPool>
+    {
+    public:
+        /**
+         *  Memory alignment of every buffer. Enough for unbuffered (O_DIRECT) I/O.
+         */
+        static constexpr uint64_t alignment = 4096;
+
+        /**
+         *  A buffer on loan from the pool. It goes back to the pool, when destroyed or released.
+         */
+        class Buffer
+        {
+        public:
+            Buffer();
+            ~Buffer();
+
+            Buffer(Buffer&& other);
+            Buffer& operator=(Buffer&& other);
+            Buffer(Buffer const&) = delete;
+            Buffer& operator=(Buffer const&) = delete;
+
+            /**
+             *  Returns false, if the pool could not hand out a buffer.
+             */
+            explicit operator bool() const;
+
+            char* data() const;
+
+            /**
+             *  Returns the usable size, which might be less than requested. See BufferPool::acquire.
+             */
+            uint64_t size() const;
+
+            void release();
+
+        private:
+            friend class BufferPool;
+            Buffer(std::shared_ptr <BufferPool> pool, char* data, uint64_t capacity, uint64_t size);
+
+        private:
+            std::shared_ptr <BufferPool> pool_;
+            char* data_;
+            uint64_t capacity_;
+            uint64_t size_;
+        };
+
+        /**
+         *  @param limit The maximum amount of memory of all buffers together.
+         */
+        explicit BufferPool(uint64_t limit = 256 * 1024 * 1024 /* 256 MB */);
+        ~BufferPool();
+
+        BufferPool(BufferPool const&) = delete;
+        BufferPool& operator=(BufferPool const&) = delete;
+
+        /**
+         *  Hands out a buffer of at least "size" bytes, but never more than getMaxBufferSize().
+         *  Thread safe.
+         *
+         *  @return Returns an empty buffer, if the memory limit is reached. Try again after buffers were given back.
+         */
+        Buffer acquire(uint64_t size);
+
+        /**
+         *  The largest buffer that is handed out, an eighth of the limit.
+         *  Keeps a single huge request from taking all the memory.
+         */
+        uint64_t getMaxBufferSize() const;
+
+        uint64_t getLimit() const;
+
+        /**
+         *  Returns the memory held by the pool, idle buffers included.
+         */
+        uint64_t getAllocated() const;
+
+        /**
+         *  Returns the memory of the buffers that are currently handed out.
+         */
+        uint64_t getInUse() const;
+
+    private:
+        void giveBack(char* data, uint64_t capacity);
+        bool freeIdleBuffer();
+
+    private:
+        mutable std::mutex lock_;
+        std::map <uint64_t /* capacity */, std::vector <char*>> idle_;
+        uint64_t limit_;
+        uint64_t maxBufferSize_;
+        uint64_t allocated_;
+        uint64_t inUse_;
+    };
+}
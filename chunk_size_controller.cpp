@@ -0,0 +1,77 @@
+#include "chunk_size_controller.hpp"
+
+#include <algorithm>
+
+namespace FileSpreader
+{
+//#####################################################################################################################
+    ChunkSizeController::ChunkSizeController(uint64_t minChunkSize, uint64_t maxChunkSize, uint64_t initialChunkSize,
+                                             std::chrono::milliseconds targetLatency)
+        : lock_{}
+        , minChunkSize_{minChunkSize}
+        , maxChunkSize_{std::max(minChunkSize, maxChunkSize)}
+        , chunkSize_{std::min(std::max(initialChunkSize, minChunkSize_), maxChunkSize_)}
+        , targetLatency_{targetLatency}
+        , throughput_{0.}
+        , throughputBeforeGrowth_{0.}
+        , samplesSinceChange_{0}
+        , samplesBeforeChange_{4}
+    {
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    uint64_t ChunkSizeController::getChunkSize() const
+    {
+        std::lock_guard <std::mutex> guard(lock_);
+        return chunkSize_;
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    double ChunkSizeController::getThroughput() const
+    {
+        std::lock_guard <std::mutex> guard(lock_);
+        return throughput_;
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    void ChunkSizeController::report(uint64_t requested, uint64_t transferred, std::chrono::steady_clock::duration took)
+    {
+        using namespace std::chrono;
+
+        std::lock_guard <std::mutex> guard(lock_);
+
+        auto seconds = std::max(duration_cast <duration <double>> (took).count(), 1e-6);
+        auto sample = transferred / seconds;
+        throughput_ = throughput_ == 0. ? sample : 0.8 * throughput_ + 0.2 * sample;
+        ++samplesSinceChange_;
+
+        // too slow for a timely progress, no matter the size.
+        if (took > targetLatency_ * 2)
+        {
+            chunkSize_ = std::max(chunkSize_ / 2, minChunkSize_);
+            throughputBeforeGrowth_ = 0.;
+            samplesSinceChange_ = 0;
+            return;
+        }
+
+        // tail chunks of files and chunks of an older size tell nothing about the current size.
+        if (transferred < requested || requested != chunkSize_ || samplesSinceChange_ < samplesBeforeChange_)
+            return;
+
+        // the last growth made things worse, go back.
+        if (throughputBeforeGrowth_ > 0. && throughput_ < throughputBeforeGrowth_ * 0.9)
+        {
+            chunkSize_ = std::max(chunkSize_ / 2, minChunkSize_);
+            throughputBeforeGrowth_ = 0.;
+            samplesSinceChange_ = 0;
+            samplesBeforeChange_ = 64;
+            return;
+        }
+
+        if (took < targetLatency_ / 2 && chunkSize_ < maxChunkSize_)
+        {
+            throughputBeforeGrowth_ = throughput_;
+            chunkSize_ = std::min(chunkSize_ * 2, maxChunkSize_);
+            samplesSinceChange_ = 0;
+            samplesBeforeChange_ = 4;
+        }
+    }
+//#####################################################################################################################
+}
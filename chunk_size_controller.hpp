@@ -0,0 +1,53 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+
+namespace FileSpreader
+{
+    /**
+     *  Adapts the chunk size of the copy processes of one destination.
+     *  Chunks grow while they complete quickly and throughput does not suffer, and shrink when
+     *  a chunk takes so long that the progress would only update sluggishly.
+     *  Thread safe, all copy processes of a destination report to the same controller.
+     */
+    class ChunkSizeController
+    {
+    public:
+        ChunkSizeController(uint64_t minChunkSize = 64 * 1024 /* 64 KB */,
+                            uint64_t maxChunkSize = 64 * 1024 * 1024 /* 64 MB */,
+                            uint64_t initialChunkSize = 1 * 1024 * 1024 /* 1 MB */,
+                            std::chrono::milliseconds targetLatency = std::chrono::milliseconds{50});
+
+        /**
+         *  Returns the chunk size the next chunk shall have.
+         */
+        uint64_t getChunkSize() const;
+
+        /**
+         *  Returns the smoothed throughput in bytes per second.
+         */
+        double getThroughput() const;
+
+        /**
+         *  Report a completed chunk.
+         *
+         *  @param requested The chunk size that was asked for.
+         *  @param transferred The bytes actually transferred. Less than requested at the end of a file.
+         *  @param took The time the chunk took.
+         */
+        void report(uint64_t requested, uint64_t transferred, std::chrono::steady_clock::duration took);
+
+    private:
+        mutable std::mutex lock_;
+        uint64_t minChunkSize_;
+        uint64_t maxChunkSize_;
+        uint64_t chunkSize_;
+        std::chrono::steady_clock::duration targetLatency_;
+        double throughput_;
+        double throughputBeforeGrowth_; // 0 if the last change was not a growth
+        unsigned int samplesSinceChange_;
+        unsigned int samplesBeforeChange_; // hysteresis, larger after a growth had to be undone.
+    };
+}
@@ -4,6 +4,7 @@
 
 #include <boost/filesystem.hpp>
 
+#include <algorithm>
 #include <thread>
 
 namespace FileSpreader
@@ -13,7 +14,8 @@ namespace FileSpreader
 //#####################################################################################################################
     Cloner::Cloner(std::string source,
                    std::vector <std::string> const& destinations,
-                   ClonerOptions const& options)
+                   ClonerOptions const& options,
+                   std::shared_ptr <BufferPool> bufferPool)
         : source_{std::move(source), options, true}
         , destinations_{[&]() {
             std::vector <DirectoryScanner> scanners;
@@ -24,55 +26,237 @@ namespace FileSpreader
         , options_{options}
         , progressReportStop_{}
         , runningCopyProcesses_{}
+        , fanOuts_{}
+        , chunkSizeControllers_{}
+        , bufferPool_{std::move(bufferPool)}
+        , lanes_{}
+        , prefetched_{}
+        , knownDirectories_{}
+        , knownDirectoriesLock_{}
+        , ring_{}
+        , watcher_{}
+        , watchedChanges_{}
         , differences_{}
         , differenceBuilt_{false}
+        , hashPairings_{}
+        , hashesQueued_{false}
         , lastWorkTime_{std::chrono::system_clock::now()}
     {
+        if (options_.isUsingAsyncIo())
+        {
+            ring_ = std::make_shared <IoRing> ();
+            if (!ring_->good())
+            {
+                Log(LogSeverity::Warning, "Asynchronous I/O is not available, falling back to synchronous copies.");
+                ring_.reset();
+            }
+        }
+
+        if (options_.isWatching())
+        {
+            // every directory is watched before the scan reads it, so no change can slip through in between.
+            watcher_ = std::make_unique <DirectoryWatcher> ();
+            if (watcher_->good())
+            {
+                source_.setDirectoryListener([this](std::string const& directory) {
+                    if (watcher_)
+                        watcher_->watch(directory);
+                });
+            }
+            else
+            {
+                Log(LogSeverity::Warning, "Cannot watch " + source_.getDirectory() + ", falling back to periodic rescans.");
+                watcher_.reset();
+            }
+        }
     }
 //---------------------------------------------------------------------------------------------------------------------
-    void Cloner::createNewCopier(std::string const& destination)
+    std::vector <std::string>* Cloner::getPendingFiles(std::string const& destination)
     {
         auto* diffPtr = differences_.find(destination)->second.getLeftDifference();
 
+        // missing files first, then the ones that changed at the source.
+        if (diffPtr->empty())
+            diffPtr = differences_.find(destination)->second.getChanged();
+
         if (diffPtr->empty() && !options_.isUsingArchiveBit())
-            return;
+            return nullptr;
 
         else if (diffPtr->empty())
         {
             diffPtr = differences_.find(destination)->second.getUnion();
             if (diffPtr->empty())
-                return;
+                return nullptr;
         }
 
-        auto& diff = *diffPtr;
-
-        auto sourceFile = fs::path(source_.getDirectory()) / diff.back();
+        return diffPtr;
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    std::shared_ptr <Copier> Cloner::startCopier(std::string const& destination, std::string const& relativeFile)
+    {
+        auto sourceFile = fs::path(source_.getDirectory()) / relativeFile;
         //auto destinationFile = getDestinationFromSource(sourceFile, destination);
-        auto destinationFile = fs::path(destination) / fs::path(diff.back());
+        auto destinationFile = fs::path(destination) / fs::path(relativeFile);
+
+        // a file that changed while it is copied, is copied again once that copy is done.
+        if (isCopying(destination, relativeFile))
+            return nullptr;
 
+        prefetched_.erase(destinationFile.string());
+
+        boost::system::error_code ec;
         auto dir = destinationFile.parent_path();
-        if (!fs::exists(dir))
-            if (!recursiveCreateDirectory(dir.string()))
-                return;
+        if (!recursiveCreateDirectory(dir.string(), ec))
+        {
+            // one destination directory that cannot be written must not stop the other tasks, try again later.
+            Log(LogSeverity::Warning, "Cannot create directory " + dir.string() + ": " + ec.message(), LOG_CODE_PLACE);
+            return nullptr;
+        }
 
-        //if (Copier::testFileAccess(sourceFile, destinationFile, options_.getTempSuffix()))
+        auto copier = std::make_shared <Copier> (
+            sourceFile.string(),
+            destinationFile.string(),
+            options_.isUsingArchiveBit(),
+            options_.getTempSuffix(),
+            1 * 1024 * 1024,
+            options_.isResumable(),
+            options_.isUsingAnonymousTempFiles()
+        );
+        copier->setDurability(options_.getDurability(), options_.getSyncInterval());
+        copier->setUseReflink(options_.isUsingReflink());
+        copier->setLargeFileThreshold(options_.getLargeFileThreshold());
+        copier->setBufferPool(bufferPool_);
+        copier->setParallelRanges(options_.getRangesPerFile());
+        copier->setVerify(options_.isVerifying());
+        if (options_.isUsingAdaptiveChunkSize())
         {
-            runningCopyProcesses_.emplace(
-                std::piecewise_construct,
-                std::forward_as_tuple(destination),
-                std::forward_as_tuple(
-                    sourceFile.string(),
-                    destinationFile.string(),
-                    options_.isUsingArchiveBit(),
-                    options_.getTempSuffix()
-                )
-            );
+            auto& controller = chunkSizeControllers_[destination];
+            if (!controller)
+                controller = std::make_shared <ChunkSizeController> ();
+            copier->setChunkSizeController(controller);
+        }
+        if (ring_)
+            copier->setAsyncRing(ring_);
+        runningCopyProcesses_[destination].push_back(copier);
+
+        Log(LogSeverity::Debug, "Started: "s + destinationFile.make_preferred().string() + ".");
+
+        return copier;
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    bool Cloner::isCopying(std::string const& destination, std::string const& relativeFile) const
+    {
+        auto running = runningCopyProcesses_.find(destination);
+        if (running == std::end(runningCopyProcesses_))
+            return false;
+
+        auto destinationFile = (fs::path(destination) / fs::path(relativeFile)).string();
+        return std::any_of(std::begin(running->second), std::end(running->second), [&destinationFile](auto const& copier) {
+            return copier->getDestinationFile() == destinationFile;
+        });
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    uint64_t Cloner::getScannedSize(std::string const& relativeFile) const
+    {
+        auto const* metadata = source_.findMetadata(relativeFile);
+        return metadata != nullptr ? metadata->size : 0;
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    Cloner::Lane Cloner::getLane(uint64_t size) const
+    {
+        if (size <= options_.getSmallFileThreshold() && options_.getSmallFileThreshold() > 0)
+            return Lane::Small;
+        else if (size >= options_.getLargeLaneThreshold() && options_.getLargeLaneThreshold() > 0)
+            return Lane::Large;
+        else
+            return Lane::Medium;
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    std::deque <Cloner::PendingFile>& Cloner::Lanes::get(Lane lane)
+    {
+        if (lane == Lane::Small)
+            return small;
+        else if (lane == Lane::Large)
+            return large;
+        else
+            return medium;
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    std::size_t Cloner::Lanes::size() const
+    {
+        return small.size() + medium.size() + large.size();
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    void Cloner::classifyPending(std::string const& destination, Lane wanted)
+    {
+        auto& lanes = lanes_[destination];
+        auto* pending = getPendingFiles(destination);
+
+        // only look as far as needed to find the next one of the lane.
+        for (int i = 0; i != 64 && pending != nullptr && !pending->empty() && lanes.get(wanted).empty(); ++i)
+        {
+            auto size = getScannedSize(pending->back());
+            lanes.get(getLane(size)).push_back(PendingFile{std::move(pending->back()), size});
+            pending->pop_back();
+            if (pending->empty())
+                pending = getPendingFiles(destination);
+        }
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    void Cloner::createNewCopier(std::string const& destination, Lane lane)
+    {
+        classifyPending(destination, lane);
 
-            Log(LogSeverity::Debug, "Started: "s + destinationFile.make_preferred().string() + ".");
+        auto& queue = lanes_[destination].get(lane);
+
+        // a file still being copied goes to the back of its lane, the files behind it do not wait for that copy.
+        for (std::size_t i = 0; i != queue.size() && isCopying(destination, queue.front().file); ++i)
+        {
+            queue.push_back(std::move(queue.front()));
+            queue.pop_front();
         }
+        if (queue.empty() || isCopying(destination, queue.front().file))
+            return;
+
+        auto relativeFile = queue.front().file;
+
+        //if (Copier::testFileAccess(sourceFile, destinationFile, options_.getTempSuffix()))
+        auto copier = startCopier(destination, relativeFile);
+        if (!copier)
+            return;
 
         // remove file from todo-list
-        diff.pop_back();
+        queue.pop_front();
+
+        if (!options_.isUsingFanOut())
+            return;
+
+        // all destinations with a free slot that need the very same file next share one read of the source.
+        // The lists are sorted and worked off in the same order, so destinations in sync line up here.
+        std::vector <std::shared_ptr <Copier>> sinks{copier};
+        for (auto const& i : destinations_)
+        {
+            if (i.getDirectory() == destination || !hasFreeSlot(i.getDirectory(), lane))
+                continue;
+
+            classifyPending(i.getDirectory(), lane);
+            auto& otherQueue = lanes_[i.getDirectory()].get(lane);
+            if (otherQueue.empty() || otherQueue.front().file != relativeFile)
+                continue;
+
+            auto sink = startCopier(i.getDirectory(), relativeFile);
+            if (!sink)
+                continue;
+
+            otherQueue.pop_front();
+            sinks.push_back(sink);
+        }
+
+        if (sinks.size() > 1)
+        {
+            fanOuts_.emplace_back(new FanOutCopier((fs::path(source_.getDirectory()) / relativeFile).string(), sinks, bufferPool_));
+            Log(LogSeverity::Debug, "Sharing read of "s + relativeFile + " with " + std::to_string(sinks.size()) + " destinations.");
+        }
     }
 //---------------------------------------------------------------------------------------------------------------------
     ClonerOptions Cloner::getOptions() const
@@ -99,9 +283,63 @@ namespace FileSpreader
         return (fs::path(destinationRoot) / fs::path(subPath)).string();
     }
 //---------------------------------------------------------------------------------------------------------------------
-    bool Cloner::recursiveCreateDirectory(std::string const& directory)
+    bool Cloner::recursiveCreateDirectory(std::string const& directory, boost::system::error_code& ec) const
+    {
+        {
+            std::lock_guard <std::mutex> guard(knownDirectoriesLock_);
+            if (knownDirectories_.find(directory) != std::end(knownDirectories_))
+                return true;
+        }
+
+        fs::create_directories(directory, ec);
+        if (ec)
+            return false;
+
+        // the parents exist now as well.
+        std::lock_guard <std::mutex> guard(knownDirectoriesLock_);
+        for (auto path = fs::path(directory); !path.empty() && knownDirectories_.insert(path.string()).second; )
+            path = path.parent_path();
+        return true;
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    void Cloner::queueDirectoryCreation(std::vector <WorkStealingPool::JobType>& jobs)
     {
-        return fs::create_directories(directory);
+        // the small lane is copied at a high rate, so look further ahead there.
+        std::size_t const lookahead = std::max <std::size_t> (options_.getPrefetchCount(), 1);
+        std::size_t const smallLookahead = 256;
+
+        for (auto const& i : destinations_)
+        {
+            auto lanes = lanes_.find(i.getDirectory());
+            if (lanes == std::end(lanes_))
+                continue;
+
+            std::set <std::string> missing;
+            {
+                std::lock_guard <std::mutex> guard(knownDirectoriesLock_);
+                auto collect = [&](std::deque <PendingFile> const& lane, std::size_t count) {
+                    for (std::size_t file = 0; file != std::min(count, lane.size()); ++file)
+                    {
+                        auto directory = (fs::path(i.getDirectory()) / lane[file].file).parent_path().string();
+                        if (knownDirectories_.find(directory) == std::end(knownDirectories_))
+                            missing.insert(directory);
+                    }
+                };
+                collect(lanes->second.small, smallLookahead);
+                collect(lanes->second.medium, lookahead);
+                collect(lanes->second.large, lookahead);
+            }
+
+            if (missing.empty())
+                continue;
+
+            // one job per destination, the directories of a destination often share parents.
+            jobs.push_back([this, missing]() {
+                boost::system::error_code ec;
+                for (auto const& directory : missing)
+                    recursiveCreateDirectory(directory, ec); // the copy process reports errors.
+            });
+        }
     }
 //---------------------------------------------------------------------------------------------------------------------
     bool Cloner::needsRefresh(std::chrono::milliseconds const& interval) const
@@ -110,8 +348,20 @@ namespace FileSpreader
         if (!reportLock.try_lock())
             return false;
 
+        // the rescans of the loaded lists are the refresh.
+        if (isProvisional())
+            return false;
+
+        // changes of a watched source arrive as they happen.
+        if (watcher_)
+            return false;
+
         for (auto const& i : differences_)
-            if (!i.second.isEmptyLeft())
+            if (!i.second.isEmptyLeft() || !i.second.isEmptyChanged())
+                return false;
+
+        for (auto const& i : lanes_)
+            if (i.second.size() > 0)
                 return false;
 
         return std::chrono::system_clock::now() - lastWorkTime_ > std::chrono::milliseconds(interval);
@@ -124,14 +374,130 @@ namespace FileSpreader
         bool somethingToDo = false;
         for (auto const& i : differences_)
         {
-            if (!i.second.isEmptyLeft())
+            if (!i.second.isEmptyLeft() || !i.second.isEmptyChanged())
             {
                 somethingToDo = true;
                 break;
             }
         }
+        for (auto const& i : lanes_)
+            somethingToDo |= i.second.size() > 0;
         return somethingToDo;
     }
+//---------------------------------------------------------------------------------------------------------------------
+    bool Cloner::isProvisional() const
+    {
+        if (source_.isProvisional())
+            return true;
+
+        for (auto const& i : destinations_)
+            if (i.isProvisional())
+                return true;
+
+        return false;
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    bool Cloner::adoptRescans()
+    {
+        if (!isProvisional())
+            return false;
+
+        if (!source_.rescanFinished())
+            return false;
+        for (auto const& i : destinations_)
+            if (!i.rescanFinished())
+                return false;
+
+        // the difference refers into the lists, they can only be swapped once it is worked off.
+        if (!runningCopyProcesses_.empty() || !fanOuts_.empty())
+            return false;
+        for (auto const& i : differences_)
+            if (!i.second.isEmptyLeft() || !i.second.isEmptyChanged())
+                return false;
+        for (auto const& i : lanes_)
+            if (i.second.size() > 0)
+                return false;
+
+        source_.adoptRescan();
+        for (auto& i : destinations_)
+            i.adoptRescan();
+
+        differenceBuilt_ = false;
+        differences_.clear();
+        hashPairings_.clear();
+        hashesQueued_ = false;
+        lanes_.clear();
+        prefetched_.clear();
+        {
+            std::lock_guard <std::mutex> guard(knownDirectoriesLock_);
+            knownDirectories_.clear();
+        }
+
+        Log(LogSeverity::Info, "The lists loaded from the scan index of " + source_.getDirectory() + " were verified.");
+        return true;
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    DirectoryScanner* Cloner::findDestination(std::string const& directory)
+    {
+        for (auto& i : destinations_)
+            if (i.getDirectory() == directory)
+                return &i;
+        return nullptr;
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    DirectoryWatcher const* Cloner::getWatcher() const
+    {
+        return watcher_.get();
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    void Cloner::pollWatcher()
+    {
+        if (!watcher_)
+            return;
+
+        auto changes = watcher_->poll();
+        if (changes.overflow)
+        {
+            // nobody knows what was missed.
+            Log(LogSeverity::Warning, "Changes in " + source_.getDirectory() + " were missed, scanning it again.");
+            watchedChanges_.clear();
+            refresh();
+            return;
+        }
+
+        watchedChanges_.insert(std::begin(changes.files), std::end(changes.files));
+
+        if (!watcher_->good())
+        {
+            Log(LogSeverity::Warning, "Cannot watch all of " + source_.getDirectory() + ", falling back to periodic rescans.");
+            source_.setDirectoryListener({});
+            watcher_.reset();
+        }
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    void Cloner::queueWatchedChanges()
+    {
+        // the difference is built from the lists, which might not know about the changes yet.
+        if (watchedChanges_.empty() || !differenceBuilt_)
+            return;
+
+        std::size_t queued = 0;
+        for (auto const& file : watchedChanges_)
+        {
+            if (!source_.recordFile(file))
+                continue;
+
+            // pending files are taken from the back, so the latest change is copied next.
+            auto relativeFile = file.substr(source_.getDirectory().length());
+            for (auto& i : differences_)
+                i.second.getChanged()->push_back(relativeFile);
+            ++queued;
+        }
+        watchedChanges_.clear();
+
+        if (queued > 0)
+            Log(LogSeverity::Debug, std::to_string(queued) + " changed files of " + source_.getDirectory() + " queued.");
+    }
 //---------------------------------------------------------------------------------------------------------------------
     void Cloner::refresh()
     {
@@ -139,6 +505,14 @@ namespace FileSpreader
 
         source_.reset();
         differences_.clear();
+        hashPairings_.clear();
+        hashesQueued_ = false;
+        lanes_.clear();
+        prefetched_.clear();
+        {
+            std::lock_guard <std::mutex> guard(knownDirectoriesLock_);
+            knownDirectories_.clear();
+        }
 
         for (auto& i : destinations_)
             i.reset();
@@ -156,19 +530,28 @@ namespace FileSpreader
         return true;
     }
 //---------------------------------------------------------------------------------------------------------------------
-    void Cloner::scan(int amount)
+    void Cloner::scan(int amount, WorkStealingPool& executor)
     {
         if (scanDone())
             return;
 
-        source_.scan(amount);
-
-        uint64_t count = source_.getFileCount();
+        std::vector <DirectoryScanner*> scanners{&source_};
         for (auto& i : destinations_)
+            scanners.push_back(&i);
+
+        std::vector <WorkStealingPool::JobType> jobs;
+        for (auto* scanner : scanners)
         {
-            i.scan(amount);
-            count += i.getFileCount();
+            jobs.push_back([scanner, amount, &executor]() {
+                scanner->scan(amount, &executor);
+                scanner->rescan(amount, &executor);
+            });
         }
+        executor.run(jobs);
+
+        uint64_t count = source_.getFileCount();
+        for (auto const& i : destinations_)
+            count += i.getFileCount();
 
         if (count > 0)
             Log(LogSeverity::Info, std::to_string(count) + " files scanned.");
@@ -185,6 +568,14 @@ namespace FileSpreader
             auto diff = differences_.find(i.getDirectory());
             if (diff == std::end(differences_))
             {
+                // everything the scan came across exists, no need to ask the file system again.
+                {
+                    std::lock_guard <std::mutex> guard(knownDirectoriesLock_);
+                    knownDirectories_.insert(i.getDirectory());
+                    for (auto const& directory : i.getDirectories())
+                        knownDirectories_.insert((fs::path(i.getDirectory()) / directory).string());
+                }
+
                 differences_.emplace(
                     std::piecewise_construct,
                     std::forward_as_tuple(i.getDirectory()),
@@ -194,6 +585,20 @@ namespace FileSpreader
                     )
                 );
                 diff = differences_.find(i.getDirectory());
+
+                auto const policy = options_.getComparisonPolicy();
+                if (policy != ComparisonPolicy::Path)
+                {
+                    // a copy carries the time of its source, as far as the file system of the destination keeps it.
+                    auto timeWindow = options_.getModifyWindow();
+                    if (timeWindow < 0)
+                        timeWindow = NativeFile::modificationTimeWindow(i.getDirectory());
+
+                    diff->second.setChangePredicate([this, destination = &i, policy, timeWindow](std::string const& sourceFile, std::string const& destinationFile)
+                    {
+                        return source_.hasChanged(sourceFile, *destination, destinationFile, policy, timeWindow);
+                    });
+                }
             }
             differenceBuilt_ &= !source_.findDifference(diff->second, i, amount);
         }
@@ -206,6 +611,77 @@ namespace FileSpreader
     {
         return differenceBuilt_;
     }
+//---------------------------------------------------------------------------------------------------------------------
+    bool Cloner::hashFiles(int amount, WorkStealingPool& executor)
+    {
+        if (!scanDone())
+            return false;
+
+        // only files of the same path and size are compared by hash. The lists are sorted, walk them side by side.
+        if (!hashesQueued_)
+        {
+            hashesQueued_ = true;
+            for (auto& i : destinations_)
+            {
+                auto pairing = hashPairings_.find(i.getDirectory());
+                if (pairing == std::end(hashPairings_))
+                {
+                    pairing = hashPairings_.emplace(
+                        i.getDirectory(),
+                        HashPairing{std::begin(*source_.getList()), std::begin(*i.getList())}
+                    ).first;
+                }
+
+                auto& source = pairing->second.source;
+                auto& destination = pairing->second.destination;
+                for (int step = 0; step != amount; ++step)
+                {
+                    if (source == std::end(*source_.getList()) || destination == std::end(*i.getList()))
+                        break;
+
+                    if (*source < *destination)
+                        ++source;
+                    else if (*destination < *source)
+                        ++destination;
+                    else
+                    {
+                        auto const* sourceMetadata = source_.getMetadata(*source);
+                        auto const* destinationMetadata = i.getMetadata(*destination);
+                        if (sourceMetadata != nullptr && destinationMetadata != nullptr &&
+                            sourceMetadata->size == destinationMetadata->size)
+                        {
+                            source_.queueHash(*source);
+                            i.queueHash(*destination);
+                        }
+                        ++source;
+                        ++destination;
+                    }
+                }
+                hashesQueued_ &= source == std::end(*source_.getList()) || destination == std::end(*i.getList());
+            }
+            if (!hashesQueued_)
+                return false;
+        }
+
+        // every scanner reads its share of the budget, the source as much as all destinations together.
+        std::vector <DirectoryScanner*> scanners{&source_};
+        for (auto& i : destinations_)
+            scanners.push_back(&i);
+
+        uint64_t const budget = 64 * 1024 * 1024;
+        std::vector <char> done(scanners.size(), 0);
+        std::vector <WorkStealingPool::JobType> jobs;
+        for (std::size_t i = 0; i != scanners.size(); ++i)
+        {
+            auto const share = i == 0 ? budget / 2 : budget / 2 / (scanners.size() - 1);
+            jobs.push_back([scanner = scanners[i], share, &done, i, &executor]() {
+                done[i] = scanner->hashQueued(share, &executor);
+            });
+        }
+        executor.run(jobs);
+
+        return std::all_of(std::begin(done), std::end(done), [](char d){return d != 0;});
+    }
 //---------------------------------------------------------------------------------------------------------------------
     boost::optional <SourceGroupProgress> Cloner::compileProgressReport(bool verbose) const
     {
@@ -220,34 +696,52 @@ namespace FileSpreader
         {
             DestinationProgress desProg;
             desProg.destination = desti.getDirectory();
-            desProg.remainingFileCount = differences_.find(desti.getDirectory())->second.leftSize();
             desProg.scanFileCount = desti.getFileCount();
 
             auto runningCpy = runningCopyProcesses_.find(desti.getDirectory());
             if (runningCpy != std::end(runningCopyProcesses_))
             {
-                desProg.currentFile = runningCpy->second.getDestinationFile();
-                if (runningCpy->second.getProgressMax() != 0)
-                    desProg.currentFileProgress = (100. * runningCpy->second.getProgress()) / runningCpy->second.getProgressMax();
-                else
-                    desProg.currentFileProgress = 100.;
-            }
-            else
-            {
-                desProg.currentFile = "";
-                desProg.currentFileProgress = 0.;
+                for (auto const& copier : runningCpy->second)
+                {
+                    FileProgress fileProg;
+                    fileProg.file = copier->getDestinationFile();
+                    if (copier->getProgressMax() != 0)
+                        fileProg.progress = (100. * copier->getProgress()) / copier->getProgressMax();
+                    else
+                        fileProg.progress = 100.;
+                    desProg.currentFiles.push_back(fileProg);
+                }
             }
 
             auto remFiles = differences_.find(desti.getDirectory());
             if (remFiles != std::end(differences_))
             {
                 if (verbose)
+                {
                     desProg.remainingFiles = remFiles->second.getLeftDifference();
+                    auto const& changed = remFiles->second.getChanged();
+                    desProg.remainingFiles.insert(std::end(desProg.remainingFiles), std::begin(changed), std::end(changed));
+                }
 
-                desProg.remainingFileCount = remFiles->second.leftSize();
+                desProg.remainingFileCount = remFiles->second.leftSize() + remFiles->second.changedSize();
             }
             else
+            {
                 desProg.remainingFiles = {};
+                desProg.remainingFileCount = 0;
+            }
+
+            // files sorted into lanes are still to do.
+            auto lanes = lanes_.find(desti.getDirectory());
+            if (lanes != std::end(lanes_))
+            {
+                if (verbose)
+                    for (auto const* lane : {&lanes->second.small, &lanes->second.medium, &lanes->second.large})
+                        for (auto const& i : *lane)
+                            desProg.remainingFiles.push_back(i.file);
+
+                desProg.remainingFileCount += lanes->second.size();
+            }
 
             result.destinations.push_back(desProg);
         }
@@ -259,64 +753,253 @@ namespace FileSpreader
     {
         std::lock_guard <decltype(progressReportStop_)> reportLock(progressReportStop_);
 
+        fanOuts_.clear();
         runningCopyProcesses_.clear();
         differences_.clear();
+        hashPairings_.clear();
+        hashesQueued_ = false;
+        lanes_.clear();
+        prefetched_.clear();
+
+        std::lock_guard <std::mutex> guard(knownDirectoriesLock_);
+        knownDirectories_.clear();
     }
 //---------------------------------------------------------------------------------------------------------------------
-    void Cloner::tryAssignTasks()
+    std::size_t Cloner::getRunningCount(std::string const& destination, Lane lane) const
     {
-        if (runningCopyProcesses_.size() == destinations_.size())
-            return;
+        auto running = runningCopyProcesses_.find(destination);
+        if (running == std::end(runningCopyProcesses_))
+            return 0;
 
+        // small files only end up here, if there is no small lane. They use the medium slots then.
+        return std::count_if(std::begin(running->second), std::end(running->second), [this, lane](auto const& copier) {
+            return (getLane(copier->getProgressMax()) == Lane::Large) == (lane == Lane::Large);
+        });
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    bool Cloner::hasFreeSlot(std::string const& destination, Lane lane) const
+    {
+        if (lane == Lane::Large)
+            return getRunningCount(destination, lane) < options_.getLargeFilesPerDestination();
+        else
+            return getRunningCount(destination, lane) < options_.getFilesPerDestination();
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    void Cloner::tryAssignTasks()
+    {
         for (auto const& i : destinations_)
         {
-            auto m = runningCopyProcesses_.find(i.getDirectory());
-            if (m != std::end(runningCopyProcesses_))
-                continue; // there is a running task for this destination
-
-            // assign new work
-            createNewCopier(i.getDirectory());
+            // assign new work, until all slots of a lane are taken or there is nothing left to do in it.
+            for (auto lane : {Lane::Large, Lane::Medium})
+            {
+                while (hasFreeSlot(i.getDirectory(), lane))
+                {
+                    auto runningBefore = getRunningCount(i.getDirectory(), lane);
+                    createNewCopier(i.getDirectory(), lane);
+                    if (getRunningCount(i.getDirectory(), lane) == runningBefore)
+                        break;
+                }
+            }
         }
     }
 //---------------------------------------------------------------------------------------------------------------------
     void Cloner::clearFinishedTasks()
     {
         std::vector <std::string> eraseList;
+        std::vector <std::pair <DirectoryScanner*, std::shared_ptr <Copier>>> finished;
 
         for (auto& i : runningCopyProcesses_)
         {
-            if (i.second.isDone())
-            {
-                eraseList.push_back(i.first);
-                Log(LogSeverity::Debug, "Finished: "s + fs::path(i.second.getDestinationFile()).make_preferred().string() + ".");
-            }
-            else if (!i.second.isGood())
-            {
+            auto& copiers = i.second;
+            auto* destination = findDestination(i.first);
+            copiers.erase(
+                std::remove_if(std::begin(copiers), std::end(copiers), [destination, &finished](auto const& copier) {
+                    if (copier->isDone())
+                    {
+                        Log(LogSeverity::Debug, "Finished: "s + fs::path(copier->getDestinationFile()).make_preferred().string() + ".");
+                        finished.emplace_back(destination, copier);
+                        return true;
+                    }
+                    else if (!copier->isGood())
+                    {
+                        Log(LogSeverity::Warning, "Removed ill copy process involving: "s + fs::path(copier->getDestinationFile()).make_preferred().string() + ".");
+                        return true;
+                    }
+                    return false;
+                }),
+                std::end(copiers)
+            );
+
+            if (copiers.empty())
                 eraseList.push_back(i.first);
-                Log(LogSeverity::Warning, "Removed ill copy process involving: "s + fs::path(i.second.getDestinationFile()).make_preferred().string() + ".");
-            }
         }
 
         for (auto const& i : eraseList)
             runningCopyProcesses_.erase(i);
+
+        // the copy gets its final name, when the copy process is destroyed. Only then it can be recorded.
+        for (auto& i : finished)
+        {
+            auto destinationFile = i.second->getDestinationFile();
+            bool verified = i.second->getVerification() == Verification::Verified;
+            i.second.reset();
+
+            if (i.first != nullptr)
+                i.first->recordFile(destinationFile, verified);
+        }
+
+        fanOuts_.erase(
+            std::remove_if(std::begin(fanOuts_), std::end(fanOuts_), [](auto const& fanOut) {
+                return fanOut->isDone();
+            }),
+            std::end(fanOuts_)
+        );
     }
 //---------------------------------------------------------------------------------------------------------------------
-    bool Cloner::pulse(int scanMax)
+    void Cloner::queuePrefetches(std::vector <WorkStealingPool::JobType>& jobs)
+    {
+        auto const lookahead = options_.getPrefetchCount();
+        if (lookahead == 0)
+            return;
+
+        // enough for the first chunks, the copy itself keeps the read ahead going.
+        uint64_t const prefetchBytes = 4 * 1024 * 1024;
+
+        std::set <std::string> sources; // a file needed by several destinations is read ahead once.
+        for (auto const& i : destinations_)
+        {
+            auto lanes = lanes_.find(i.getDirectory());
+            if (lanes == std::end(lanes_))
+                continue;
+
+            // the small lane is copied right away, there is nothing to win.
+            std::vector <std::string> next;
+            for (auto const* lane : {&lanes->second.medium, &lanes->second.large})
+                for (std::size_t file = 0; file != std::min(lookahead, lane->size()); ++file)
+                    next.push_back((*lane)[file].file);
+
+            for (auto const& file : next)
+            {
+                auto destinationFile = (fs::path(i.getDirectory()) / file).string();
+                if (!prefetched_.insert(destinationFile).second)
+                    continue;
+
+                auto sourceFile = (fs::path(source_.getDirectory()) / file).string();
+                bool readAhead = sources.insert(sourceFile).second;
+                if (!readAhead)
+                    continue;
+
+                jobs.push_back([sourceFile, prefetchBytes]() {
+                    NativeFile::prefetch(sourceFile, prefetchBytes);
+                });
+            }
+        }
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    void Cloner::copySmallFiles(std::string const& destination, std::vector <std::string>* pending, Lanes& lanes,
+                                std::vector <CopiedFile>& handled) const
+    {
+        auto const threshold = options_.getSmallFileThreshold();
+        auto const deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(20);
+        uint64_t const byteBudget = 64 * 1024 * 1024;
+        std::size_t const sortedAhead = 1024; // the other lanes do not need to know more files in advance.
+
+        uint64_t bytes = 0;
+        bool outOfMemory = false;
+        std::deque <PendingFile> deferred;
+        while (bytes < byteBudget && std::chrono::steady_clock::now() < deadline)
+        {
+            boost::system::error_code ec;
+            if (lanes.small.empty())
+            {
+                if (pending == nullptr || pending->empty() || lanes.medium.size() + lanes.large.size() >= sortedAhead)
+                    break;
+
+                auto size = getScannedSize(pending->back());
+                lanes.get(getLane(size)).push_back(PendingFile{std::move(pending->back()), size});
+                pending->pop_back();
+                continue;
+            }
+
+            // a file that is being copied already would be written to the same temp file, it waits for that copy.
+            // A file that changed again is queued again with the watched changes, it is copied then.
+            if (isCopying(destination, lanes.small.front().file))
+            {
+                deferred.push_back(std::move(lanes.small.front()));
+                lanes.small.pop_front();
+                continue;
+            }
+            if (watchedChanges_.count(source_.getDirectory() + lanes.small.front().file) != 0)
+            {
+                lanes.small.pop_front();
+                continue;
+            }
+
+            auto const size = lanes.small.front().size;
+            auto sourceFile = fs::path(source_.getDirectory()) / lanes.small.front().file;
+            auto destinationFile = fs::path(destination) / lanes.small.front().file;
+
+            recursiveCreateDirectory(destinationFile.parent_path().string(), ec);
+            {
+                Copier copier(sourceFile.string(), destinationFile.string(), options_.isUsingArchiveBit(),
+                              options_.getTempSuffix(), threshold, false, options_.isUsingAnonymousTempFiles());
+                copier.setDurability(options_.getDurability(), options_.getSyncInterval());
+                copier.setUseReflink(options_.isUsingReflink());
+                copier.setBufferPool(bufferPool_);
+                copier.setVerify(options_.isVerifying());
+
+                while (copier.isGood() && !copier.isDone())
+                {
+                    auto before = copier.getProgress() + copier.getVerifiedBytes();
+                    copier.copyChunk();
+                    if (copier.isGood() && !copier.isDone() && copier.getProgress() + copier.getVerifiedBytes() == before)
+                    {
+                        outOfMemory = true; // the copy is discarded and retried next pulse.
+                        break;
+                    }
+                }
+                if (outOfMemory)
+                    break;
+
+                if (copier.isDone())
+                    handled.push_back(CopiedFile{destinationFile.string(), copier.getVerification() == Verification::Verified});
+                else
+                    Log(LogSeverity::Warning, "Removed ill copy process involving: "s + destinationFile.make_preferred().string() + ".");
+            }
+
+            bytes += size;
+            lanes.small.pop_front();
+        }
+
+        for (auto& i : deferred)
+            lanes.small.push_back(std::move(i));
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    bool Cloner::pulse(int scanMax, WorkStealingPool& executor)
     {
         std::unique_lock <decltype(progressReportStop_)> reportLock(progressReportStop_, std::defer_lock);
         if (!reportLock.try_lock())
             return true;
 
+        // the kernel queues only so many events, keep collecting them while scanning.
+        pollWatcher();
+
         // we are scanning now, so scan and return true (work was done)
         if (!scanDone())
         {
-            scan(scanMax);
+            scan(scanMax, executor);
             lastWorkTime_ = std::chrono::system_clock::now();
             return true;
         }
 
         if (!differenceFound())
         {
+            // hashes are read ahead, the difference walk itself does not touch the files.
+            if (options_.getComparisonPolicy() == ComparisonPolicy::Hash && !hashFiles(100'000, executor))
+            {
+                lastWorkTime_ = std::chrono::system_clock::now();
+                return true;
+            }
             findDifference(100'000);
             lastWorkTime_ = std::chrono::system_clock::now();
             return true;
@@ -325,17 +1008,127 @@ namespace FileSpreader
         // remove finished copy processes.
         clearFinishedTasks();
 
+        if (adoptRescans())
+        {
+            lastWorkTime_ = std::chrono::system_clock::now();
+            return true;
+        }
+
+        queueWatchedChanges();
+
         // fill "runningCopyProcesses_"
         tryAssignTasks();
 
-        // copy a chunk for every open file
+        // copy a chunk for every open file. They are independent from each other, so run them all at once.
+        std::vector <WorkStealingPool::JobType> jobs;
+        for (auto& i : fanOuts_)
+        {
+            auto* fanOut = i.get();
+            jobs.push_back([fanOut, &executor]() {
+                fanOut->copyChunk(&executor);
+            });
+        }
+
         for (auto& i : runningCopyProcesses_)
-            i.second.copyChunk();
+        {
+            for (auto& running : i.second)
+            {
+                if (running->isFedExternally())
+                    continue;
+
+                // asynchronous copies only queue requests, no need to hand that to another thread.
+                if (running->getEngine() == CopyEngine::IoUring)
+                {
+                    running->copyChunk();
+                    continue;
+                }
+
+                auto* copier = running.get();
+                jobs.push_back([copier, &executor]() {
+                    copier->copyChunk(&executor);
+                });
+            }
+        }
+
+        // small files are done in batches, next to the regular copy processes.
+        std::vector <std::vector <CopiedFile>> smallFilesHandled(destinations_.size());
+        if (options_.getSmallFileThreshold() > 0)
+        {
+            for (std::size_t i = 0; i != destinations_.size(); ++i)
+            {
+                auto destination = destinations_[i].getDirectory();
+                auto* pending = getPendingFiles(destination);
+                auto* lanes = &lanes_[destination];
+                if (pending == nullptr && lanes->small.empty())
+                    continue;
+
+                auto* handled = &smallFilesHandled[i];
+                jobs.push_back([this, destination, pending, lanes, handled]() {
+                    copySmallFiles(destination, pending, *lanes, *handled);
+                });
+            }
+        }
+
+        queueDirectoryCreation(jobs);
+        queuePrefetches(jobs);
+
+        // lists loaded from the scan index are verified next to the copies, the rescan does not touch them.
+        if (!source_.rescanFinished())
+        {
+            jobs.push_back([this, scanMax, &executor]() {
+                source_.rescan(scanMax, &executor);
+            });
+        }
+        for (auto& i : destinations_)
+        {
+            if (i.rescanFinished())
+                continue;
 
-        if (!runningCopyProcesses_.empty())
+            auto* scanner = &i;
+            jobs.push_back([scanner, scanMax, &executor]() {
+                scanner->rescan(scanMax, &executor);
+            });
+        }
+
+        // submit the asynchronous batch first, so it runs while the synchronous copies do.
+        if (ring_)
+            ring_->pump();
+
+        executor.run(jobs);
+
+        // nothing else to do but waiting for the ring? Then wait instead of spinning.
+        if (ring_)
+            ring_->pump(jobs.empty());
+
+        bool smallFilesCopied = false;
+        for (std::size_t i = 0; i != destinations_.size(); ++i)
+        {
+            auto const& handled = smallFilesHandled[i];
+            if (handled.empty())
+                continue;
+
+            for (auto const& copied : handled)
+            {
+                prefetched_.erase(copied.file);
+                destinations_[i].recordFile(copied.file, copied.verified);
+            }
+
+            smallFilesCopied = true;
+            Log(LogSeverity::Debug, "Copied "s + std::to_string(handled.size()) + " small files to " + destinations_[i].getDirectory() + ".");
+        }
+
+        if (!runningCopyProcesses_.empty() || smallFilesCopied)
+        {
             lastWorkTime_ = std::chrono::system_clock::now();
+            return true;
+        }
+
+        // idle, a good time to persist what was copied.
+        source_.flushIndex();
+        for (auto& i : destinations_)
+            i.flushIndex();
 
-        return !runningCopyProcesses_.empty();
+        return isProvisional();
     }
 //#####################################################################################################################
 }
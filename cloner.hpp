@@ -2,17 +2,22 @@
 
 #include "cloner_options.hpp"
 #include "copier.hpp"
+#include "fan_out_copier.hpp"
 #include "progress_report.hpp"
 #include "directory_scanner.hpp"
+#include "directory_watcher.hpp"
 #include "set_symmetry.hpp"
+#include "work_stealing_pool.hpp"
 
 #include <boost/filesystem.hpp>
 #include <boost/optional.hpp>
 
+#include <deque>
 #include <set>
 #include <string>
 #include <vector>
 #include <map>
+#include <memory>
 #include <mutex>
 #include <functional>
 #include <chrono>
@@ -25,19 +30,24 @@ namespace FileSpreader
     class Cloner
     {
     public:
+        /**
+         *  @param bufferPool Copy buffers, shared with other tasks.
+         */
         Cloner(std::string source,
                std::vector <std::string> const& destinations,
-               ClonerOptions const& options);
+               ClonerOptions const& options,
+               std::shared_ptr <BufferPool> bufferPool);
 
         Cloner(Cloner const&) = delete;
         Cloner& operator=(Cloner const&) = delete;
 
         /**
          *  Copies new chunks for every task.
+         *  The copy processes run in parallel on the executor.
          *
          *  @return Returns if any work was done.
          */
-        bool pulse(int scanMax);
+        bool pulse(int scanMax, WorkStealingPool& executor);
 
         /**
          *  Stops all copy and resets them (files deleted or renamed, if finished).
@@ -46,10 +56,15 @@ namespace FileSpreader
 
         /**
          *  A refresh is needed, if all of the destinations do not have any files copied to and
-         *  the refresh wait time has elapsed.
+         *  the refresh wait time has elapsed. Never, while the source is watched.
          */
         bool needsRefresh(std::chrono::milliseconds const& interval) const;
 
+        /**
+         *  Returns the watcher of the source, or nullptr if it is not watched.
+         */
+        DirectoryWatcher const* getWatcher() const;
+
         /**
          *  Gets the options back.
          */
@@ -85,13 +100,88 @@ namespace FileSpreader
          */
         bool differenceFound() const;
 
+        /**
+         *  Hashes the files, that the hash comparison needs, on the executor. Files of the same path and size in
+         *  source and destination are queued, at most "amount" at a time, and read up to a budget per call.
+         *
+         *  @return Returns true, once every such file is hashed.
+         */
+        bool hashFiles(int amount, WorkStealingPool& executor);
+
         /**
          *  Another directory scan will be performed next pulse, if no work is available
          */
         void refresh();
 
     private:
-        void createNewCopier(std::string const& destination);
+        /**
+         *  Pending files are scheduled in lanes by their size. Every lane has its own budget of running copies,
+         *  so a huge file does not hold back the small ones behind it.
+         */
+        enum class Lane
+        {
+            Small, // copied in batches by copySmallFiles.
+            Medium, // options_.getFilesPerDestination() at a time.
+            Large // options_.getLargeFilesPerDestination() at a time.
+        };
+
+        struct PendingFile
+        {
+            std::string file; // relative to the source
+            uint64_t size;
+        };
+
+        struct CopiedFile
+        {
+            std::string file; // absolute destination file
+            bool verified; // read back and equal to its source.
+        };
+
+        /**
+         *  The files of a destination, that were taken from its pending list and sorted into lanes.
+         *  Every lane keeps the order of the pending list.
+         */
+        struct Lanes
+        {
+            std::deque <PendingFile> small;
+            std::deque <PendingFile> medium;
+            std::deque <PendingFile> large;
+
+            std::deque <PendingFile>& get(Lane lane);
+            std::size_t size() const;
+        };
+
+        void createNewCopier(std::string const& destination, Lane lane);
+
+        Lane getLane(uint64_t size) const;
+
+        /**
+         *  Returns the size of a source file (relative) as scanned, or 0 if it is not listed.
+         *  Sorting files into lanes must not touch the file system, the copy process finds out what changed.
+         */
+        uint64_t getScannedSize(std::string const& relativeFile) const;
+
+        /**
+         *  Moves files from the pending list into the lanes, until the given lane has a file or the
+         *  per call limit of files is reached.
+         */
+        void classifyPending(std::string const& destination, Lane wanted);
+
+        /**
+         *  Starts a copy process of a file (relative to the source) to the destination.
+         *  Returns nullptr, if the destination directory cannot be created or the file is being copied already.
+         */
+        std::shared_ptr <Copier> startCopier(std::string const& destination, std::string const& relativeFile);
+
+        /**
+         *  Returns whether a copy process of the file (relative to the source) to the destination is running.
+         */
+        bool isCopying(std::string const& destination, std::string const& relativeFile) const;
+
+        /**
+         *  Returns the list of files still to be copied to the destination, or nullptr if there is nothing to do.
+         */
+        std::vector <std::string>* getPendingFiles(std::string const& destination);
 
         // amount of running processes != destinations.size() ?
         // -> assign new tasks for the destinations.
@@ -99,12 +189,68 @@ namespace FileSpreader
 
         void clearFinishedTasks();
 
+        /**
+         *  Adds jobs that read ahead the next pending files of every destination,
+         *  so the copies start warm once a slot frees up. Every file is prepared once.
+         */
+        void queuePrefetches(std::vector <WorkStealingPool::JobType>& jobs);
+
+        /**
+         *  Adds a job per destination, that creates the missing directories of the next pending files in one go,
+         *  ahead of the copy processes.
+         */
+        void queueDirectoryCreation(std::vector <WorkStealingPool::JobType>& jobs);
+
+        /**
+         *  Copies the small files of the destination one after another, start to finish, until the time or byte
+         *  budget of this pulse is used up. Saves the scheduling round trip per file, that dominates copying small files.
+         *  Continues sorting the pending list into the lanes, while the small lane runs dry.
+         *  Only touches the pending list and lanes of this destination, so destinations can run in parallel.
+         *
+         *  @param handled Receives the destination files that were copied.
+         */
+        void copySmallFiles(std::string const& destination, std::vector <std::string>* pending, Lanes& lanes,
+                            std::vector <CopiedFile>& handled) const;
+
+        std::size_t getRunningCount(std::string const& destination, Lane lane) const;
+        bool hasFreeSlot(std::string const& destination, Lane lane) const;
+
         bool hasEmptyRemainingFilesList() const;
 
+        /**
+         *  Returns whether a list of a scanner was loaded from the scan index and is not verified yet.
+         */
+        bool isProvisional() const;
+
+        /**
+         *  Once the rescans of all provisional lists are finished and there is nothing left to copy,
+         *  the lists are replaced and the difference is built anew. Returns true, if that happened.
+         */
+        bool adoptRescans();
+
+        DirectoryScanner* findDestination(std::string const& directory);
+
+        /**
+         *  Collects the changes of a watched source. Missed changes make for a refresh.
+         */
+        void pollWatcher();
+
+        /**
+         *  Puts the collected changes in front of the pending files of every destination, once there is a difference.
+         */
+        void queueWatchedChanges();
+
         std::string getDestinationFromSource(std::string const& sourceFile, std::string const& destinationRoot) const;
-        bool recursiveCreateDirectory(std::string const& directory);
+        /**
+         *  Creates a destination directory with all its parents, unless it is known to exist.
+         *  Thread safe. Returns false on error, with "ec" set.
+         */
+        bool recursiveCreateDirectory(std::string const& directory, boost::system::error_code& ec) const;
 
-        void scan(int amount);
+        /**
+         *  Scans the source and all destinations side by side, each one spreads its directories over the executor.
+         */
+        void scan(int amount, WorkStealingPool& executor);
 
     private:
         /** The source directory to clone from. **/
@@ -119,8 +265,39 @@ namespace FileSpreader
         /** A lock that keeps stops copying while a progress report is in the making */
         mutable std::timed_mutex progressReportStop_;
 
-        /** Every destination may have a running copy process **/
-        std::map <std::string /* destination dir */, Copier> runningCopyProcesses_;
+        /** Every destination may have up to options_.getFilesPerDestination() running copy processes **/
+        std::map <std::string /* destination dir */, std::vector <std::shared_ptr <Copier>>> runningCopyProcesses_;
+
+        /** Shared reads, that feed copy processes of multiple destinations with the same file **/
+        std::vector <std::unique_ptr <FanOutCopier>> fanOuts_;
+
+        /** Learns the best chunk size for every destination, kept across refreshes **/
+        std::map <std::string /* destination dir */, std::shared_ptr <ChunkSizeController>> chunkSizeControllers_;
+
+        /** Copy buffers of all copy processes **/
+        std::shared_ptr <BufferPool> bufferPool_;
+
+        /** Pending files sorted by size, per destination **/
+        std::map <std::string /* destination dir */, Lanes> lanes_;
+
+        /** Destination files, that were already prepared by queuePrefetches, but not started yet **/
+        std::set <std::string> prefetched_;
+
+        /**
+         *  Destination directories known to exist, from the destination scans and from creating them.
+         *  Saves a stat per copied file, which hurts on network shares. Cleared on refresh.
+         */
+        mutable std::set <std::string> knownDirectories_;
+        mutable std::mutex knownDirectoriesLock_;
+
+        /** Asynchronous I/O queue shared by all copy processes of this task, if enabled **/
+        std::shared_ptr <IoRing> ring_;
+
+        /** Reports changes of the source, if it is watched **/
+        std::unique_ptr <DirectoryWatcher> watcher_;
+
+        /** Changed source files (full paths) that are not queued yet **/
+        std::set <std::string> watchedChanges_;
 
         /** The difference extractors **/
         std::map <
@@ -131,6 +308,17 @@ namespace FileSpreader
         /** Has the difference been built from the file lists? **/
         bool differenceBuilt_;
 
+        /** How far the files to hash are queued, per destination dir **/
+        struct HashPairing
+        {
+            std::set <std::string>::iterator source;
+            std::set <std::string>::iterator destination;
+        };
+        std::map <std::string, HashPairing> hashPairings_;
+
+        /** Are all the files to hash queued? **/
+        bool hashesQueued_;
+
         /** Last time work was done **/
         std::chrono::system_clock::time_point lastWorkTime_;
     };
@@ -1,4 +1,5 @@
 #include "cloner_options.hpp"
+#include "log.hpp"
 
 namespace FileSpreader
 {
@@ -85,11 +86,111 @@ namespace FileSpreader
     {
         return useArchiveBit_;
     }
+//---------------------------------------------------------------------------------------------------------------------
+    bool ClonerOptions::isUsingFanOut() const
+    {
+        return useFanOut_;
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    std::size_t ClonerOptions::getFilesPerDestination() const
+    {
+        return filesPerDestination_;
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    std::size_t ClonerOptions::getLargeFilesPerDestination() const
+    {
+        return largeFilesPerDestination_;
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    std::size_t ClonerOptions::getRangesPerFile() const
+    {
+        return rangesPerFile_;
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    bool ClonerOptions::isUsingAsyncIo() const
+    {
+        return useAsyncIo_;
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    DurabilityPolicy ClonerOptions::getDurability() const
+    {
+        return durability_;
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    uint64_t ClonerOptions::getSyncInterval() const
+    {
+        return syncInterval_;
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    bool ClonerOptions::isUsingAdaptiveChunkSize() const
+    {
+        return useAdaptiveChunkSize_;
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    bool ClonerOptions::isResumable() const
+    {
+        return resumable_;
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    bool ClonerOptions::isUsingAnonymousTempFiles() const
+    {
+        return useAnonymousTempFiles_;
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    bool ClonerOptions::isVerifying() const
+    {
+        return verify_;
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    ComparisonPolicy ClonerOptions::getComparisonPolicy() const
+    {
+        return comparison_;
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    int64_t ClonerOptions::getModifyWindow() const
+    {
+        return modifyWindow_;
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    bool ClonerOptions::isUsingReflink() const
+    {
+        return useReflink_;
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    uint64_t ClonerOptions::getLargeFileThreshold() const
+    {
+        return largeFileThreshold_;
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    uint64_t ClonerOptions::getLargeLaneThreshold() const
+    {
+        return largeLaneThreshold_;
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    std::size_t ClonerOptions::getPrefetchCount() const
+    {
+        return prefetchCount_;
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    uint64_t ClonerOptions::getSmallFileThreshold() const
+    {
+        return smallFileThreshold_;
+    }
 //---------------------------------------------------------------------------------------------------------------------
     std::string ClonerOptions::getTempSuffix() const
     {
         return temporarySuffix_;
     }
+//---------------------------------------------------------------------------------------------------------------------
+    std::string ClonerOptions::getIndexDirectory() const
+    {
+        return indexDirectory_;
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    bool ClonerOptions::isWatching() const
+    {
+        return watch_;
+    }
 //---------------------------------------------------------------------------------------------------------------------
     DestinationFilters& ClonerOptions::getDestinationOptions(std::string const& destination)
     {
@@ -100,11 +201,111 @@ namespace FileSpreader
     {
         useArchiveBit_ = useArchive;
     }
+//---------------------------------------------------------------------------------------------------------------------
+    void ClonerOptions::setUseFanOut(bool useFanOut)
+    {
+        useFanOut_ = useFanOut;
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    void ClonerOptions::setFilesPerDestination(std::size_t count)
+    {
+        filesPerDestination_ = count > 0 ? count : 1;
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    void ClonerOptions::setLargeFilesPerDestination(std::size_t count)
+    {
+        largeFilesPerDestination_ = count > 0 ? count : 1;
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    void ClonerOptions::setRangesPerFile(std::size_t count)
+    {
+        rangesPerFile_ = count > 0 ? count : 1;
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    void ClonerOptions::setUseAsyncIo(bool useAsyncIo)
+    {
+        useAsyncIo_ = useAsyncIo;
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    void ClonerOptions::setDurability(DurabilityPolicy policy)
+    {
+        durability_ = policy;
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    void ClonerOptions::setSyncInterval(uint64_t bytes)
+    {
+        syncInterval_ = bytes;
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    void ClonerOptions::setUseAdaptiveChunkSize(bool adaptive)
+    {
+        useAdaptiveChunkSize_ = adaptive;
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    void ClonerOptions::setResumable(bool resumable)
+    {
+        resumable_ = resumable;
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    void ClonerOptions::setUseAnonymousTempFiles(bool anonymous)
+    {
+        useAnonymousTempFiles_ = anonymous;
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    void ClonerOptions::setVerify(bool verify)
+    {
+        verify_ = verify;
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    void ClonerOptions::setComparisonPolicy(ComparisonPolicy policy)
+    {
+        comparison_ = policy;
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    void ClonerOptions::setModifyWindow(int64_t nanoseconds)
+    {
+        modifyWindow_ = nanoseconds;
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    void ClonerOptions::setUseReflink(bool useReflink)
+    {
+        useReflink_ = useReflink;
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    void ClonerOptions::setLargeFileThreshold(uint64_t bytes)
+    {
+        largeFileThreshold_ = bytes;
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    void ClonerOptions::setLargeLaneThreshold(uint64_t bytes)
+    {
+        largeLaneThreshold_ = bytes;
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    void ClonerOptions::setPrefetchCount(std::size_t count)
+    {
+        prefetchCount_ = count;
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    void ClonerOptions::setSmallFileThreshold(uint64_t bytes)
+    {
+        smallFileThreshold_ = bytes;
+    }
 //---------------------------------------------------------------------------------------------------------------------
     void ClonerOptions::setTempSuffix(std::string const& suffix)
     {
         temporarySuffix_ = suffix;
     }
+//---------------------------------------------------------------------------------------------------------------------
+    void ClonerOptions::setIndexDirectory(std::string const& directory)
+    {
+        indexDirectory_ = directory;
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    void ClonerOptions::setWatch(bool watch)
+    {
+        watch_ = watch;
+    }
 //#####################################################################################################################
     ClonerOptions ClonerOptionsFromMessage(Messages::Task const& taskMessage)
     {
@@ -115,6 +316,85 @@ namespace FileSpreader
         else
             options.setUseArchiveBit(false);
 
+        if (taskMessage.fanOut)
+            options.setUseFanOut(taskMessage.fanOut.get());
+
+        if (taskMessage.filesPerDestination)
+            options.setFilesPerDestination(taskMessage.filesPerDestination.get());
+
+        if (taskMessage.largeFilesPerDestination)
+            options.setLargeFilesPerDestination(taskMessage.largeFilesPerDestination.get());
+
+        if (taskMessage.rangesPerFile)
+            options.setRangesPerFile(taskMessage.rangesPerFile.get());
+
+        if (taskMessage.asyncIo)
+            options.setUseAsyncIo(taskMessage.asyncIo.get());
+
+        if (taskMessage.durability)
+        {
+            // one mistyped field must not cost the whole task list, the default is safe.
+            auto durability = durabilityPolicyFromString(taskMessage.durability.get());
+            if (durability)
+                options.setDurability(durability.get());
+            else
+            {
+                Log(LogSeverity::Error, "Unknown durability policy \"" + taskMessage.durability.get() + "\" in the task of " +
+                    taskMessage.source + ", using \"" + durabilityPolicyToString(options.getDurability()) + "\".", LOG_CODE_PLACE);
+            }
+        }
+
+        if (taskMessage.syncIntervalMb && taskMessage.syncIntervalMb.get() > 0)
+            options.setSyncInterval(taskMessage.syncIntervalMb.get() * 1024 * 1024);
+
+        if (taskMessage.adaptiveChunkSize)
+            options.setUseAdaptiveChunkSize(taskMessage.adaptiveChunkSize.get());
+
+        if (taskMessage.resumable)
+            options.setResumable(taskMessage.resumable.get());
+
+        if (taskMessage.anonymousTempFiles)
+            options.setUseAnonymousTempFiles(taskMessage.anonymousTempFiles.get());
+
+        if (taskMessage.verify)
+            options.setVerify(taskMessage.verify.get());
+
+        if (taskMessage.comparison)
+        {
+            auto comparison = comparisonPolicyFromString(taskMessage.comparison.get());
+            if (comparison)
+                options.setComparisonPolicy(comparison.get());
+            else
+            {
+                Log(LogSeverity::Error, "Unknown comparison policy \"" + taskMessage.comparison.get() + "\" in the task of " +
+                    taskMessage.source + ", using \"" + comparisonPolicyToString(options.getComparisonPolicy()) + "\".", LOG_CODE_PLACE);
+            }
+        }
+
+        if (taskMessage.modifyWindowMs)
+            options.setModifyWindow(static_cast <int64_t> (taskMessage.modifyWindowMs.get()) * 1'000'000);
+
+        if (taskMessage.reflink)
+            options.setUseReflink(taskMessage.reflink.get());
+
+        if (taskMessage.largeFileThresholdMb)
+            options.setLargeFileThreshold(taskMessage.largeFileThresholdMb.get() * 1024 * 1024);
+
+        if (taskMessage.largeLaneThresholdMb)
+            options.setLargeLaneThreshold(taskMessage.largeLaneThresholdMb.get() * 1024 * 1024);
+
+        if (taskMessage.prefetchCount)
+            options.setPrefetchCount(taskMessage.prefetchCount.get());
+
+        if (taskMessage.smallFileThresholdKb)
+            options.setSmallFileThreshold(taskMessage.smallFileThresholdKb.get() * 1024);
+
+        if (taskMessage.indexDirectory)
+            options.setIndexDirectory(taskMessage.indexDirectory.get());
+
+        if (taskMessage.watch)
+            options.setWatch(taskMessage.watch.get());
+
         for (auto const& i : taskMessage.destinations)
         {
             auto& destOpts = options.getDestinationOptions(i.directory);
@@ -129,5 +409,55 @@ namespace FileSpreader
 
         return options;
     }
+//---------------------------------------------------------------------------------------------------------------------
+    std::string durabilityPolicyToString(DurabilityPolicy policy)
+    {
+        switch (policy)
+        {
+        case DurabilityPolicy::SyncOnClose:
+            return "close";
+        case DurabilityPolicy::SyncPeriodically:
+            return "periodic";
+        default:
+            return "none";
+        }
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    boost::optional <DurabilityPolicy> durabilityPolicyFromString(std::string const& policy)
+    {
+        if (policy == "none")
+            return DurabilityPolicy::None;
+        else if (policy == "close")
+            return DurabilityPolicy::SyncOnClose;
+        else if (policy == "periodic")
+            return DurabilityPolicy::SyncPeriodically;
+        else
+            return boost::none;
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    std::string comparisonPolicyToString(ComparisonPolicy policy)
+    {
+        switch (policy)
+        {
+        case ComparisonPolicy::Path:
+            return "path";
+        case ComparisonPolicy::Hash:
+            return "hash";
+        default:
+            return "time";
+        }
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    boost::optional <ComparisonPolicy> comparisonPolicyFromString(std::string const& policy)
+    {
+        if (policy == "path")
+            return ComparisonPolicy::Path;
+        else if (policy == "time")
+            return ComparisonPolicy::SizeAndTime;
+        else if (policy == "hash")
+            return ComparisonPolicy::Hash;
+        else
+            return boost::none;
+    }
 //#####################################################################################################################
 }
@@ -1,14 +1,27 @@
 #pragma once
 
 #include "filter.hpp"
+#include "copier.hpp"
 #include "messages/task.hpp"
 
+#include <boost/optional.hpp>
+
 #include <vector>
 #include <string>
 #include <map>
 
 namespace FileSpreader
 {
+    /**
+     *  How a file that exists on both sides is found to be out of date.
+     */
+    enum class ComparisonPolicy
+    {
+        Path, // never, only missing files are copied.
+        SizeAndTime, // the size or the modification time differs (beyond the modify window), copies carry the time of their source.
+        Hash // the size or the content differs. Reads every file that exists on both sides.
+    };
+
     class DestinationFilters
     {
     public:
@@ -45,18 +58,92 @@ namespace FileSpreader
     {
     public:
         bool isUsingArchiveBit() const;
+        bool isUsingFanOut() const;
+        std::size_t getFilesPerDestination() const;
+        std::size_t getLargeFilesPerDestination() const;
+        std::size_t getRangesPerFile() const;
+        bool isUsingAsyncIo() const;
+        DurabilityPolicy getDurability() const;
+        bool isUsingAdaptiveChunkSize() const;
+        bool isResumable() const;
+        bool isUsingAnonymousTempFiles() const;
+        bool isVerifying() const;
+        ComparisonPolicy getComparisonPolicy() const;
+        int64_t getModifyWindow() const;
+        bool isUsingReflink() const;
+        uint64_t getLargeFileThreshold() const;
+        uint64_t getLargeLaneThreshold() const;
+        std::size_t getPrefetchCount() const;
+        uint64_t getSmallFileThreshold() const;
+        uint64_t getSyncInterval() const;
         std::string getTempSuffix() const;
+        std::string getIndexDirectory() const;
+        bool isWatching() const;
 
         // setters
         DestinationFilters& getDestinationOptions(std::string const& destination);
         void setUseArchiveBit(bool useArchive);
+        void setUseFanOut(bool useFanOut);
+        void setFilesPerDestination(std::size_t count);
+        void setLargeFilesPerDestination(std::size_t count);
+        void setRangesPerFile(std::size_t count);
+        void setUseAsyncIo(bool useAsyncIo);
+        void setDurability(DurabilityPolicy policy);
+        void setUseAdaptiveChunkSize(bool adaptive);
+        void setResumable(bool resumable);
+        void setUseAnonymousTempFiles(bool anonymous);
+        void setVerify(bool verify);
+        void setComparisonPolicy(ComparisonPolicy policy);
+        void setModifyWindow(int64_t nanoseconds);
+        void setUseReflink(bool useReflink);
+        void setLargeFileThreshold(uint64_t bytes);
+        void setLargeLaneThreshold(uint64_t bytes);
+        void setPrefetchCount(std::size_t count);
+        void setSmallFileThreshold(uint64_t bytes);
+        void setSyncInterval(uint64_t bytes);
         void setTempSuffix(std::string const& suffix);
+        void setIndexDirectory(std::string const& directory);
+        void setWatch(bool watch);
 
     private:
         std::map <std::string, DestinationFilters> destinationOptions_ = {};
         std::string temporarySuffix_ = ".fs.temp"; // this will be implicitly black listed.
         bool useArchiveBit_ = false;
+        bool useFanOut_ = false; // read a file once for all destinations that need it.
+        std::size_t filesPerDestination_ = 1; // files copied at the same time to each destination.
+        std::size_t largeFilesPerDestination_ = 1; // additionally, files at or above the large lane threshold.
+        std::size_t rangesPerFile_ = 1; // parts of a big file that are copied concurrently. 1 = off.
+        bool useAsyncIo_ = false; // io_uring on linux, ignored elsewhere.
+        DurabilityPolicy durability_ = DurabilityPolicy::None;
+        uint64_t syncInterval_ = 64 * 1024 * 1024; // only used by DurabilityPolicy::SyncPeriodically
+        bool useAdaptiveChunkSize_ = true; // otherwise chunks are 1 MB.
+        bool resumable_ = false; // keep interrupted copies and continue them later, leaves their temp files behind.
+        bool useAnonymousTempFiles_ = false; // O_TMPFILE on linux, for copies that are not resumable.
+        bool verify_ = false; // hash the data while copying and compare it to a second, full read of the destination.
+        ComparisonPolicy comparison_ = ComparisonPolicy::Path; // finds files that changed at the source.
+        int64_t modifyWindow_ = -1; // nanoseconds modification times may differ by and be equal, -1 = by file system.
+        bool useReflink_ = true; // clone files on copy on write file systems instead of copying them.
+        uint64_t largeFileThreshold_ = 1024 * 1024 * 1024; // bigger files bypass the page cache, 0 = never.
+        uint64_t largeLaneThreshold_ = 1024 * 1024 * 1024; // bigger files have their own slots, 0 = never.
+        std::size_t prefetchCount_ = 4; // pending files per destination that are prepared ahead, 0 = none.
+        uint64_t smallFileThreshold_ = 64 * 1024; // files up to this size are copied in batches, 0 = never.
+        std::string indexDirectory_ = {}; // where the scans are persisted for the next start, empty = nowhere.
+        bool watch_ = false; // follow the changes of the source as they happen (inotify), instead of rescanning it.
     };
 
     ClonerOptions ClonerOptionsFromMessage(Messages::Task const& taskMessage);
+
+    /**
+     *  Converts between the policy and its name in a task message ("none", "close" or "periodic").
+     *  An unknown name gives none.
+     */
+    std::string durabilityPolicyToString(DurabilityPolicy policy);
+    boost::optional <DurabilityPolicy> durabilityPolicyFromString(std::string const& policy);
+
+    /**
+     *  Converts between the policy and its name in a task message ("path", "time" or "hash").
+     *  An unknown name gives none.
+     */
+    std::string comparisonPolicyToString(ComparisonPolicy policy);
+    boost::optional <ComparisonPolicy> comparisonPolicyFromString(std::string const& policy);
 }
@@ -0,0 +1,141 @@
+#include "content_hash.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace FileSpreader
+{
+//#####################################################################################################################
+    namespace
+    {
+        constexpr uint64_t prime1 = 11400714785074694791ull;
+        constexpr uint64_t prime2 = 14029467366897019727ull;
+        constexpr uint64_t prime3 = 1609587929392839161ull;
+        constexpr uint64_t prime4 = 9650029242287828579ull;
+        constexpr uint64_t prime5 = 2870177450012600261ull;
+
+        uint64_t rotateLeft(uint64_t value, int bits)
+        {
+            return (value << bits) | (value >> (64 - bits));
+        }
+        // the algorithm is defined on little endian input.
+        uint64_t read64(unsigned char const* data)
+        {
+            uint64_t result;
+            std::memcpy(&result, data, sizeof(result));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+            result = __builtin_bswap64(result);
+#endif
+            return result;
+        }
+        uint64_t read32(unsigned char const* data)
+        {
+            uint32_t result;
+            std::memcpy(&result, data, sizeof(result));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+            result = __builtin_bswap32(result);
+#endif
+            return result;
+        }
+        uint64_t round(uint64_t lane, uint64_t input)
+        {
+            lane += input * prime2;
+            lane = rotateLeft(lane, 31);
+            return lane * prime1;
+        }
+        uint64_t mergeRound(uint64_t hash, uint64_t lane)
+        {
+            hash ^= round(0, lane);
+            return hash * prime1 + prime4;
+        }
+    }
+//#####################################################################################################################
+    ContentHash::ContentHash(uint64_t seed)
+        : lanes_{seed + prime1 + prime2, seed + prime2, seed, seed - prime1}
+        , pending_{}
+        , pendingSize_(0)
+        , totalSize_(0)
+        , seed_(seed)
+    {
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    void ContentHash::consumeStripe(unsigned char const* stripe)
+    {
+        lanes_[0] = round(lanes_[0], read64(stripe));
+        lanes_[1] = round(lanes_[1], read64(stripe + 8));
+        lanes_[2] = round(lanes_[2], read64(stripe + 16));
+        lanes_[3] = round(lanes_[3], read64(stripe + 24));
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    void ContentHash::update(char const* data, uint64_t size)
+    {
+        auto const* input = reinterpret_cast <unsigned char const*> (data);
+        totalSize_ += size;
+
+        if (pendingSize_ > 0)
+        {
+            auto fill = std::min <uint64_t> (size, sizeof(pending_) - pendingSize_);
+            std::memcpy(pending_ + pendingSize_, input, fill);
+            pendingSize_ += fill;
+            input += fill;
+            size -= fill;
+
+            if (pendingSize_ < sizeof(pending_))
+                return;
+
+            consumeStripe(pending_);
+            pendingSize_ = 0;
+        }
+
+        for (; size >= sizeof(pending_); input += sizeof(pending_), size -= sizeof(pending_))
+            consumeStripe(input);
+
+        std::memcpy(pending_, input, size);
+        pendingSize_ = size;
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    uint64_t ContentHash::digest() const
+    {
+        uint64_t hash;
+        if (totalSize_ >= sizeof(pending_))
+        {
+            hash = rotateLeft(lanes_[0], 1) + rotateLeft(lanes_[1], 7) + rotateLeft(lanes_[2], 12) + rotateLeft(lanes_[3], 18);
+            for (auto lane : lanes_)
+                hash = mergeRound(hash, lane);
+        }
+        else
+        {
+            hash = seed_ + prime5;
+        }
+
+        hash += totalSize_;
+
+        auto const* tail = pending_;
+        auto remaining = pendingSize_;
+        for (; remaining >= 8; tail += 8, remaining -= 8)
+        {
+            hash ^= round(0, read64(tail));
+            hash = rotateLeft(hash, 27) * prime1 + prime4;
+        }
+        if (remaining >= 4)
+        {
+            hash ^= read32(tail) * prime1;
+            hash = rotateLeft(hash, 23) * prime2 + prime3;
+            tail += 4;
+            remaining -= 4;
+        }
+        for (; remaining > 0; ++tail, --remaining)
+        {
+            hash ^= *tail * prime5;
+            hash = rotateLeft(hash, 11) * prime1;
+        }
+
+        hash ^= hash >> 33;
+        hash *= prime2;
+        hash ^= hash >> 29;
+        hash *= prime3;
+        hash ^= hash >> 32;
+        return hash;
+    }
+//#####################################################################################################################
+}
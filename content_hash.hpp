@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstdint>
+
+namespace FileSpreader
+{
+    /**
+     *  A streaming 64 bit content hash (the XXH64 algorithm), fed chunk by chunk while a file is copied.
+     *  Four independent lanes keep the multiplier pipelines busy, so hashing runs at memory speed
+     *  and does not slow the copy down. Not cryptographic, it catches corruption, not tampering.
+     */
+    class ContentHash
+    {
+    public:
+        explicit ContentHash(uint64_t seed = 0);
+
+        /**
+         *  Hashes the next "size" bytes of the stream.
+         */
+        void update(char const* data, uint64_t size);
+
+        /**
+         *  Returns the hash of everything passed to update so far. More data may follow.
+         */
+        uint64_t digest() const;
+
+    private:
+        void consumeStripe(unsigned char const* stripe);
+
+    private:
+        uint64_t lanes_[4];
+        unsigned char pending_[32]; // the tail that does not fill a stripe yet.
+        uint64_t pendingSize_;
+        uint64_t totalSize_;
+        uint64_t seed_;
+    };
+}
@@ -23,14 +23,17 @@ namespace FileSpreader
             return 0;
     }
 //#####################################################################################################################
-    Controller::Controller(int scanMax)
+    Controller::Controller(int scanMax, unsigned int threadCount, uint64_t bufferMemory)
         : interval_(5000)
+        , bufferPool_(std::make_shared <BufferPool> (bufferMemory))
         , cloners_()
         , pulser_()
+        , executor_(threadCount)
         , running_(false)
         , scanMax_{scanMax}
     {
-        Log("Controller created.");
+        Log("Controller created with "s + std::to_string(executor_.getThreadCount()) + " copy threads and " +
+            std::to_string(bufferPool_->getLimit() / (1024 * 1024)) + " MB of copy buffers.");
     }
 //---------------------------------------------------------------------------------------------------------------------
     void Controller::setUpdateInterval(std::chrono::milliseconds const& sleepTime)
@@ -61,7 +64,8 @@ namespace FileSpreader
             std::forward_as_tuple(
                 source,
                 destinations,
-                options
+                options,
+                bufferPool_
             )
         );
 
@@ -94,6 +98,28 @@ namespace FileSpreader
             Task task;
             task.source = i.second.getSource();
             task.useArchiveBit = options.isUsingArchiveBit();
+            task.fanOut = options.isUsingFanOut();
+            task.filesPerDestination = options.getFilesPerDestination();
+            task.asyncIo = options.isUsingAsyncIo();
+            task.durability = durabilityPolicyToString(options.getDurability());
+            task.syncIntervalMb = options.getSyncInterval() / (1024 * 1024);
+            task.adaptiveChunkSize = options.isUsingAdaptiveChunkSize();
+            task.resumable = options.isResumable();
+            task.reflink = options.isUsingReflink();
+            task.largeFileThresholdMb = options.getLargeFileThreshold() / (1024 * 1024);
+            task.largeLaneThresholdMb = options.getLargeLaneThreshold() / (1024 * 1024);
+            task.prefetchCount = options.getPrefetchCount();
+            task.smallFileThresholdKb = options.getSmallFileThreshold() / 1024;
+            task.largeFilesPerDestination = options.getLargeFilesPerDestination();
+            task.rangesPerFile = options.getRangesPerFile();
+            task.anonymousTempFiles = options.isUsingAnonymousTempFiles();
+            task.verify = options.isVerifying();
+            task.comparison = comparisonPolicyToString(options.getComparisonPolicy());
+            if (options.getModifyWindow() >= 0)
+                task.modifyWindowMs = static_cast <uint64_t> (options.getModifyWindow() / 1'000'000);
+            if (!options.getIndexDirectory().empty())
+                task.indexDirectory = options.getIndexDirectory();
+            task.watch = options.isWatching();
 
             for (auto const& d : i.second.getDestinations())
             {
@@ -172,6 +198,8 @@ namespace FileSpreader
         ProgressReport result;
         result.totalRemainingBytes = 0;
         result.totalRemainingFiles = 0;
+        result.bufferMemoryUsed = bufferPool_->getAllocated();
+        result.bufferMemoryLimit = bufferPool_->getLimit();
 
         for (auto const& i : cloners_)
         {
@@ -202,7 +230,8 @@ namespace FileSpreader
                         std::replace(remFile.begin(), remFile.end(), '/', '\\');
                     }
 
-                std::replace(sink.currentFile.begin(), sink.currentFile.end(), '/', '\\');
+                for (auto& current : sink.currentFiles)
+                    std::replace(current.file.begin(), current.file.end(), '/', '\\');
             }
         }
 
@@ -245,7 +274,7 @@ namespace FileSpreader
                         std::this_thread::yield();
 
                         if (!didSomeWork)
-                            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+                            waitForChanges(std::chrono::milliseconds(50));
 
                         // refreshes the clones, if the need to be refreshed.
                         refreshAllCloners();
@@ -279,11 +308,31 @@ namespace FileSpreader
 //---------------------------------------------------------------------------------------------------------------------
     bool Controller::pulseAllCloners(int scanMax)
     {
-        bool workDone = false;
+        // every task is pulsed in parallel, and each one runs its copy processes on the same executor.
+        std::atomic_bool workDone{false};
+        std::vector <WorkStealingPool::JobType> jobs;
         for (auto& i : cloners_)
-            workDone |= i.second.pulse(scanMax);
+        {
+            auto* cloner = &i.second;
+            jobs.push_back([this, cloner, scanMax, &workDone]() {
+                if (cloner->pulse(scanMax, executor_))
+                    workDone.store(true);
+            });
+        }
+
+        executor_.run(jobs);
+
+        return workDone.load();
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    void Controller::waitForChanges(std::chrono::milliseconds const& timeout) const
+    {
+        std::vector <DirectoryWatcher const*> watchers;
+        for (auto const& i : cloners_)
+            if (i.second.getWatcher() != nullptr)
+                watchers.push_back(i.second.getWatcher());
 
-        return workDone;
+        DirectoryWatcher::wait(watchers, timeout);
     }
 //---------------------------------------------------------------------------------------------------------------------
     Controller::~Controller()
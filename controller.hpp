@@ -3,6 +3,8 @@
 #include "server_fwd.hpp"
 #include "cloner.hpp"
 #include "progress_report.hpp"
+#include "work_stealing_pool.hpp"
+#include "buffer_pool.hpp"
 
 #include <chrono>
 #include <string>
@@ -19,7 +21,12 @@ namespace FileSpreader
         friend Server; // not needed as of yet.
 
     public:
-        Controller(int scanMax);
+        /**
+         *  @param scanMax Maximum files to be scanned each round.
+         *  @param threadCount Threads that copy in parallel. 0 = one per hardware thread.
+         *  @param bufferMemory Memory limit of all copy buffers of all tasks together.
+         */
+        Controller(int scanMax, unsigned int threadCount = 0, uint64_t bufferMemory = 256 * 1024 * 1024 /* 256 MB */);
         ~Controller();
 
         /**
@@ -75,10 +82,17 @@ namespace FileSpreader
         void refreshAllCloners(bool force = false);
         bool pulseAllCloners(int scanMax);
 
+        /**
+         *  Sleeps for the timeout, but wakes up as soon as a watched source changes.
+         */
+        void waitForChanges(std::chrono::milliseconds const& timeout) const;
+
     private:
         std::chrono::milliseconds interval_;
+        std::shared_ptr <BufferPool> bufferPool_;
         std::map <std::string /* source */, Cloner> cloners_;
         std::thread pulser_;
+        WorkStealingPool executor_;
         std::atomic_bool running_;
         std::string lastError_;
         int scanMax_;
@@ -3,6 +3,21 @@
 #include "log.hpp"
 
 #include <boost/filesystem.hpp>
+#include <boost/optional.hpp>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <ctime>
+#include <fstream>
+
+#ifdef __linux__
+#   include <unistd.h>
+#   include <fcntl.h>
+#   include <sys/ioctl.h>
+#   include <sys/sendfile.h>
+#   include <linux/fs.h>
+#endif
 
 namespace FileSpreader
 {
@@ -14,30 +29,231 @@ namespace FileSpreader
         auto base = fs::path(fileName).parent_path();
         return (base / fs::path(fs::path(fileName).filename().string() + postfix)).string();
     }
+//---------------------------------------------------------------------------------------------------------------------
+    /**
+     *  Errors that indicate that a kernel side transfer is not possible between the two files,
+     *  but the buffered path may very well succeed.
+     */
+    bool isKernelCopyUnsupported(int error)
+    {
+        return error == ENOSYS || error == EXDEV || error == EINVAL || error == EOPNOTSUPP || error == ENOTSUP;
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    /**
+     *  The state of an interrupted copy. Only valid as long as the source did not change.
+     */
+    struct Checkpoint
+    {
+        uint64_t sourceSize;
+        int64_t sourceModified; // nanoseconds, as the copy started.
+        uint64_t offset;
+    };
+//---------------------------------------------------------------------------------------------------------------------
+    boost::optional <Checkpoint> readCheckpoint(std::string const& fileName)
+    {
+        std::ifstream reader(fileName, std::ios_base::binary);
+        if (!reader.good())
+            return boost::none;
+
+        Checkpoint checkpoint;
+        if (!(reader >> checkpoint.sourceSize >> checkpoint.sourceModified >> checkpoint.offset))
+            return boost::none;
+
+        return checkpoint;
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    /**
+     *  Compares the last bytes before the offset of both files.
+     *  Catches a torn tail after a crash and sources that changed without touching size or time.
+     */
+    bool tailsMatch(std::string const& lhs, std::string const& rhs, uint64_t offset)
+    {
+        uint64_t const window = std::min <uint64_t> (offset, 64 * 1024);
+        if (window == 0)
+            return true;
+
+        std::vector <char> lhsBuffer(window);
+        std::vector <char> rhsBuffer(window);
+
+        NativeFile lhsFile(lhs, FileOpenMode::Read);
+        NativeFile rhsFile(rhs, FileOpenMode::Read);
+        if (!lhsFile.seek(offset - window) || !rhsFile.seek(offset - window))
+            return false;
+
+        return lhsFile.read(lhsBuffer.data(), window) == static_cast <int64_t> (window) &&
+               rhsFile.read(rhsBuffer.data(), window) == static_cast <int64_t> (window) &&
+               lhsBuffer == rhsBuffer;
+    }
 //#####################################################################################################################
     Copier::Copier(std::string const& source, std::string const& destination, bool useArchiveBit,
-                   std::string const& tempPostfix, uint64_t chunkSize)
+                   std::string const& tempPostfix, uint64_t chunkSize, bool resumable, bool anonymousTempFile)
         : actualFile_(destination)
         , tempFile_(getTempFileName(destination, tempPostfix))
+        , checkpointFile_(getTempFileName(destination, ".resume" + tempPostfix)) // filtered like the temp file.
+        , pendingCheckpointFile_(getTempFileName(destination, ".resume.new" + tempPostfix))
         , sourceFileName_(source)
-        , source_(source, std::ios_base::binary)
-        , destination_(tempFile_, std::ios_base::binary)
-        , buffer_(chunkSize)
+        , source_(source, FileOpenMode::Read)
+        , destination_()
+        , bufferPool_()
+        , chunkSize_(chunkSize)
+#ifdef __linux__
+        , engine_(CopyEngine::CopyFileRange)
+#else
+        , engine_(CopyEngine::Buffered)
+#endif
         , copiedBytes_(0)
         , totalFileSize_(0)
+        , sourceModified_(-1)
         , illState_(false)
         , useArchiveBit_(useArchiveBit)
+        , fedExternally_(false)
+        , resumable_(resumable)
+        , anonymous_(false)
+        , tryClone_(true)
+        , preallocate_(true)
+        , sparse_(false)
+        , dataEnd_(0)
+        , largeFile_(false)
+        , pendingRelease_()
+        , verification_(Verification::Off)
+        , sourceHash_()
+        , destinationHash_()
+        , verifiedBytes_(0)
+        , readBack_()
+        , rangeCount_(1)
+        , ranges_()
+        , rangeLock_()
+        , checkpointedBytes_(0)
+        , durability_(DurabilityPolicy::None)
+        , syncInterval_(0)
+        , unsyncedBytes_(0)
+        , chunkSizeController_()
+        , ring_()
+        , asyncChunks_()
+        , asyncInFlight_(0)
+        , asyncOffset_(0)
     {
         if (source_.good())
         {
-            source_.seekg(0, std::ios_base::end);
-            totalFileSize_ = source_.tellg();
-            source_.seekg(0);
+            totalFileSize_ = source_.size();
+            sourceModified_ = source_.modificationTime();
+            sparse_ = source_.hasHoles();
         }
         else
         {
             illState_ = true;
         }
+
+        if (!resumable_ || illState_ || !tryResume())
+        {
+            if (anonymousTempFile && !resumable_ && !illState_)
+            {
+                auto directory = fs::path(actualFile_).parent_path();
+                destination_ = NativeFile(directory.empty() ? "." : directory.string(), FileOpenMode::Anonymous);
+                anonymous_ = destination_.good();
+            }
+
+            if (!anonymous_)
+                destination_ = NativeFile(tempFile_, FileOpenMode::Write);
+        }
+
+        // a clone replaces the whole file, so a resumed copy has to continue the old way.
+        tryClone_ = copiedBytes_ == 0;
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    bool Copier::tryResume()
+    {
+        auto checkpoint = readCheckpoint(checkpointFile_);
+        if (!checkpoint)
+            return false;
+
+        try
+        {
+            if (checkpoint->sourceSize != totalFileSize_ ||
+                checkpoint->sourceModified != sourceModified_ ||
+                checkpoint->offset > totalFileSize_ ||
+                !fs::exists(tempFile_) ||
+                fs::file_size(tempFile_) < checkpoint->offset)
+            {
+                return false;
+            }
+        }
+        catch (std::exception const& exc)
+        {
+            Log(LogSeverity::Warning, exc.what(), LOG_CODE_PLACE);
+            return false;
+        }
+
+        if (!tailsMatch(sourceFileName_, tempFile_, checkpoint->offset))
+        {
+            Log(LogSeverity::Info, "Checkpoint of " + tempFile_ + " does not match the source, starting over.");
+            return false;
+        }
+
+        // anything past the checkpoint is unverified.
+        destination_ = NativeFile(tempFile_, FileOpenMode::Resume);
+        if (!destination_.truncate(checkpoint->offset) ||
+            !destination_.seek(checkpoint->offset) ||
+            !source_.seek(checkpoint->offset))
+        {
+            destination_.close();
+            return false;
+        }
+
+        copiedBytes_ = checkpoint->offset;
+        checkpointedBytes_ = checkpoint->offset;
+        Log(LogSeverity::Info, "Resuming " + tempFile_ + " at " + std::to_string(copiedBytes_) + " bytes.");
+        return true;
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    void Copier::writeCheckpoint()
+    {
+        try
+        {
+            // write aside and rename, a torn checkpoint must never be read.
+            // The time is the one the copy started with, a source changed since then does not match anymore.
+            auto offset = getContiguousProgress();
+            {
+                std::ofstream writer(pendingCheckpointFile_, std::ios_base::binary);
+                writer << totalFileSize_ << " " << sourceModified_ << " " << offset << "\n";
+                if (!writer.good())
+                    return;
+            }
+            fs::rename(pendingCheckpointFile_, checkpointFile_);
+            checkpointedBytes_ = offset;
+        }
+        catch (std::exception const& exc)
+        {
+            Log(LogSeverity::Warning, exc.what(), LOG_CODE_PLACE);
+        }
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    uint64_t Copier::getContiguousProgress() const
+    {
+        // asynchronous chunks complete out of order, only the part before the oldest unfinished one is complete.
+        auto contiguous = copiedBytes_;
+        if (!ranges_.empty())
+        {
+            // every range is only complete up to its offset, anything past the first gap is unverified.
+            contiguous = totalFileSize_;
+            for (auto const& i : ranges_)
+                if (i.offset != i.end)
+                    contiguous = std::min(contiguous, i.offset);
+        }
+        else if (engine_ == CopyEngine::IoUring)
+        {
+            contiguous = asyncOffset_;
+            for (auto const& i : asyncChunks_)
+                if (i->busy)
+                    contiguous = std::min(contiguous, i->offset);
+        }
+        return contiguous;
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    void Copier::removeCheckpoint()
+    {
+        boost::system::error_code ec;
+        fs::remove(checkpointFile_, ec);
     }
 //---------------------------------------------------------------------------------------------------------------------
     bool Copier::testFileAccess(std::string const& source, std::string const& destination,
@@ -66,19 +282,59 @@ namespace FileSpreader
 //---------------------------------------------------------------------------------------------------------------------
     Copier::~Copier()
     {
+        // the kernel still references our buffers and descriptors.
+        while (asyncInFlight_ > 0 && ring_->getInFlight() > 0)
+            ring_->pump(true);
+
+        if (isDone())
+        {
+            flushReleasedCache(pendingRelease_);
+            for (auto& i : ranges_)
+                flushReleasedCache(i.release);
+
+            // the time the source had when the copy started. If it changed since, the next comparison sees it.
+            if (!destination_.setModificationTime(sourceModified_))
+                Log(LogSeverity::Warning, "Could not set the modification time of " + tempFile_ + ".", LOG_CODE_PLACE);
+        }
+
+        if (isDone() && durability_ != DurabilityPolicy::None && !destination_.sync())
+        {
+            Log(LogSeverity::Error, "Could not sync " + tempFile_ + " to disk, discarding it.", LOG_CODE_PLACE);
+            illState_ = true;
+        }
+
+        // an unnamed file is lost once it is closed.
+        if (isDone() && anonymous_ && !linkTempFile())
+            illState_ = true;
+
+        // like the periodic checkpoints, an interrupted copy is only resumable from what made it to the disk.
+        bool keepProgress = !isDone() && resumable_ && !illState_ && copiedBytes_ > 0;
+        if (keepProgress && !destination_.sync())
+        {
+            Log(LogSeverity::Warning, "Could not sync " + tempFile_ + ", it cannot be resumed.", LOG_CODE_PLACE);
+            keepProgress = false;
+        }
+
         destination_.close();
 
         if (isDone())
         {
             try
             {
-                fs::rename(tempFile_, actualFile_);
+                if (!anonymous_)
+                    fs::rename(tempFile_, actualFile_);
+
+                if (durability_ != DurabilityPolicy::None && !NativeFile::syncDirectory(fs::path(actualFile_).parent_path().string()))
+                    Log(LogSeverity::Warning, "Could not sync directory of " + actualFile_ + ".", LOG_CODE_PLACE);
 
                 if (useArchiveBit_)
                 {
                     setArchiveBit(actualFile_, ArchiveBitState::Clean); // protects against circular copy setups.
                     setArchiveBit(sourceFileName_, ArchiveBitState::Clean);
                 }
+
+                if (resumable_)
+                    removeCheckpoint();
             }
             catch(std::exception const& exc)
             {
@@ -93,8 +349,16 @@ namespace FileSpreader
                 }
             }
         }
-        else
+        else if (keepProgress)
         {
+            // interrupted, keep what we have for the next attempt.
+            writeCheckpoint();
+        }
+        else if (!anonymous_)
+        {
+            if (resumable_)
+                removeCheckpoint();
+
             try
             {
                 fs::remove(tempFile_);
@@ -105,6 +369,34 @@ namespace FileSpreader
             }
         }
     }
+//---------------------------------------------------------------------------------------------------------------------
+    bool Copier::linkTempFile()
+    {
+        if (destination_.link(actualFile_))
+            return true;
+
+        // a link never replaces the file, but the rename of a named link does, atomically.
+        boost::system::error_code ec;
+        fs::remove(tempFile_, ec);
+        if (!destination_.link(tempFile_))
+        {
+            Log(LogSeverity::Error, "Could not link the copy of " + sourceFileName_ + " to " + actualFile_ + ".",
+                LOG_CODE_PLACE);
+            return false;
+        }
+
+        try
+        {
+            fs::rename(tempFile_, actualFile_);
+            return true;
+        }
+        catch(std::exception const& exc)
+        {
+            Log(LogSeverity::Error, exc.what(), LOG_CODE_PLACE);
+            fs::remove(tempFile_, ec);
+            return false;
+        }
+    }
 //---------------------------------------------------------------------------------------------------------------------
     std::string Copier::getDestinationFile() const
     {
@@ -128,7 +420,7 @@ namespace FileSpreader
 //---------------------------------------------------------------------------------------------------------------------
     bool Copier::isDone() const
     {
-        return !illState_ && getProgress() == getProgressMax();
+        return !illState_ && getProgress() == getProgressMax() && verification_ != Verification::Pending;
     }
 //---------------------------------------------------------------------------------------------------------------------
     uint64_t Copier::getProgress() const
@@ -141,16 +433,601 @@ namespace FileSpreader
         return totalFileSize_;
     }
 //---------------------------------------------------------------------------------------------------------------------
-    void Copier::copyChunk()
+    CopyEngine Copier::getEngine() const
     {
-        if (source_.good())
+        return engine_;
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    void Copier::copyChunk(WorkStealingPool* executor)
+    {
+        if (!isGood() || isDone())
+            return;
+
+        if (copiedBytes_ == totalFileSize_)
+        {
+            verifyChunk();
+            return;
+        }
+
+        if (tryClone_)
+        {
+            tryClone_ = false;
+            if (tryClone())
+                return;
+        }
+
+        if (preallocate_ && !preallocate())
+            return;
+
+        if (rangeCount_ > 1 && (!ranges_.empty() || prepareRanges()))
+        {
+            copyRanges(executor);
+            return;
+        }
+
+        if (engine_ == CopyEngine::IoUring)
+        {
+            queueAsyncChunks();
+            return;
+        }
+
+        if (sparse_)
+        {
+            auto dataBegin = findNextData(copiedBytes_);
+            if (dataBegin != copiedBytes_)
+            {
+                if (!skipHole(copiedBytes_, dataBegin) || !source_.seek(dataBegin) || !destination_.seek(dataBegin))
+                    illState_ = true;
+                return;
+            }
+        }
+
+        auto requested = chunkSizeController_ ? chunkSizeController_->getChunkSize() : chunkSize_;
+        auto count = std::min(requested, (sparse_ ? dataEnd_ : totalFileSize_) - copiedBytes_);
+        int64_t transferred = -1;
+        auto chunkStart = std::chrono::steady_clock::now();
+
+#ifdef __linux__
+        // both kernel paths use and advance the file offsets, so they can be mixed with the buffered path.
+        if (engine_ == CopyEngine::CopyFileRange)
+        {
+            transferred = ::copy_file_range(source_.descriptor(), nullptr, destination_.descriptor(), nullptr, count, 0);
+            if (transferred < 0 && isKernelCopyUnsupported(errno))
+            {
+                Log(LogSeverity::Debug, "copy_file_range unavailable for " + tempFile_ + ", trying sendfile.");
+                engine_ = CopyEngine::SendFile;
+            }
+        }
+
+        if (engine_ == CopyEngine::SendFile)
+        {
+            transferred = ::sendfile(destination_.descriptor(), source_.descriptor(), nullptr, count);
+            if (transferred < 0 && isKernelCopyUnsupported(errno))
+            {
+                Log(LogSeverity::Debug, "sendfile unavailable for " + tempFile_ + ", using buffered copy.");
+                engine_ = CopyEngine::Buffered;
+            }
+        }
+#endif
+
+        if (engine_ == CopyEngine::Buffered)
+        {
+            // never more than the file needs, small files do not pay for a full chunk.
+            auto buffer = getBufferPool().acquire(count);
+            if (!buffer)
+                return; // out of buffer memory, other copies give theirs back until the next pulse.
+
+            transferred = source_.read(buffer.data(), buffer.size());
+            if (transferred > 0 && !destination_.write(buffer.data(), transferred))
+                transferred = -1;
+
+            if (transferred > 0 && verification_ == Verification::Pending)
+                sourceHash_.update(buffer.data(), transferred);
+        }
+
+        // 0 means the source shrank while copying, the copy is bogus.
+        if (transferred <= 0)
+        {
+            illState_ = true;
+            return;
+        }
+
+        if (chunkSizeController_)
+            chunkSizeController_->report(requested, transferred, std::chrono::steady_clock::now() - chunkStart);
+
+        releaseCache(pendingRelease_, copiedBytes_, transferred);
+        commitProgress(transferred);
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    void Copier::setDurability(DurabilityPolicy policy, uint64_t syncInterval)
+    {
+        durability_ = policy;
+        syncInterval_ = syncInterval;
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    void Copier::setChunkSizeController(std::shared_ptr <ChunkSizeController> const& controller)
+    {
+        chunkSizeController_ = controller;
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    void Copier::setUseReflink(bool useReflink)
+    {
+        tryClone_ = useReflink && copiedBytes_ == 0;
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    bool Copier::tryCloneNow()
+    {
+        if (!tryClone_ || !isGood() || fedExternally_)
+            return false;
+
+        tryClone_ = false;
+        return tryClone();
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    bool Copier::tryClone()
+    {
+#if defined(__linux__) && defined(FICLONE)
+        // fails with EXDEV across file systems and EOPNOTSUPP / EINVAL without reflink support.
+        // Either way nothing was written, the other engines start from a clean temporary file.
+        if (fedExternally_ || ::ioctl(destination_.descriptor(), FICLONE, source_.descriptor()) != 0)
+            return false;
+
+        if (destination_.size() != totalFileSize_)
+        {
+            // the source changed in between, the clone would not match what we promised.
+            illState_ = true;
+            return true;
+        }
+
+        Log(LogSeverity::Debug, "Cloned " + sourceFileName_ + " to " + tempFile_ + ".");
+        engine_ = CopyEngine::Clone;
+        if (verification_ == Verification::Pending)
+            verification_ = Verification::Verified; // the very same extents.
+        commitProgress(totalFileSize_ - copiedBytes_);
+        return true;
+#else
+        return false;
+#endif
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    void Copier::setVerify(bool verify)
+    {
+        if (!verify)
+            verification_ = Verification::Off;
+        else if (copiedBytes_ > 0 || sparse_ || engine_ == CopyEngine::IoUring)
+            verification_ = Verification::Unverifiable;
+        else
+        {
+            verification_ = Verification::Pending;
+            engine_ = CopyEngine::Buffered;
+        }
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    Verification Copier::getVerification() const
+    {
+        return verification_;
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    uint64_t Copier::getVerifiedBytes() const
+    {
+        return verifiedBytes_;
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    void Copier::verifyChunk()
+    {
+        if (!readBack_.good())
+        {
+            // the destination is opened write only. An anonymous file is only reachable through its descriptor.
+            auto fileName = anonymous_ ? "/proc/self/fd/" + std::to_string(destination_.descriptor()) : tempFile_;
+            readBack_ = NativeFile(fileName, FileOpenMode::Read);
+            if (!readBack_.good())
+            {
+                Log(LogSeverity::Error, "Could not read back " + tempFile_ + " for verification.", LOG_CODE_PLACE);
+                illState_ = true;
+                return;
+            }
+        }
+
+        if (verifiedBytes_ < totalFileSize_)
+        {
+            auto buffer = getBufferPool().acquire(std::min(chunkSize_, totalFileSize_ - verifiedBytes_));
+            if (!buffer)
+                return; // out of buffer memory, try again next pulse.
+
+            auto read = readBack_.readAt(buffer.data(), buffer.size(), verifiedBytes_);
+            if (read <= 0)
+            {
+                Log(LogSeverity::Error, "Could not read back " + tempFile_ + " for verification.", LOG_CODE_PLACE);
+                illState_ = true;
+                return;
+            }
+
+            destinationHash_.update(buffer.data(), read);
+#ifdef __linux__
+            if (largeFile_)
+                ::posix_fadvise(readBack_.descriptor(), static_cast <off_t> (verifiedBytes_), read, POSIX_FADV_DONTNEED);
+#endif
+            verifiedBytes_ += read;
+            if (verifiedBytes_ < totalFileSize_)
+                return;
+        }
+
+        readBack_.close();
+        if (destinationHash_.digest() == sourceHash_.digest())
+        {
+            Log(LogSeverity::Debug, "Verified " + actualFile_ + ".");
+            verification_ = Verification::Verified;
+        }
+        else
+        {
+            Log(LogSeverity::Error, "Verification failed, " + actualFile_ + " does not match its source. Discarding it.",
+                LOG_CODE_PLACE);
+            verification_ = Verification::Mismatch;
+            illState_ = true;
+        }
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    bool Copier::preallocate()
+    {
+        preallocate_ = false;
+
+        // reserving the holes would make the copy dense.
+        if (sparse_ || copiedBytes_ == totalFileSize_)
+            return true;
+
+        auto result = destination_.preallocate(totalFileSize_);
+        if (result == AllocationResult::Allocated)
+            return true;
+
+        if (result != AllocationResult::NoSpace)
         {
-            source_.read(buffer_.data(), buffer_.size());
-            destination_.write(buffer_.data(), source_.gcount());
-            destination_ << std::flush;
+            // nothing reserved, but a file that cannot fit is still refused before writing a single byte.
+            try
+            {
+                if (fs::space(fs::path(tempFile_).parent_path()).available >= totalFileSize_ - copiedBytes_)
+                    return true;
+            }
+            catch (fs::filesystem_error const&)
+            {
+                return true;
+            }
+        }
 
-            copiedBytes_ += source_.gcount();
+        Log(LogSeverity::Error, "Not enough space for " + actualFile_ + " (" + std::to_string(totalFileSize_) + " bytes).",
+            LOG_CODE_PLACE);
+        illState_ = true;
+        return false;
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    void Copier::setLargeFileThreshold(uint64_t threshold)
+    {
+        largeFile_ = threshold > 0 && totalFileSize_ >= threshold;
+#ifdef __linux__
+        if (largeFile_)
+            ::posix_fadvise(source_.descriptor(), 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    void Copier::setBufferPool(std::shared_ptr <BufferPool> const& pool)
+    {
+        bufferPool_ = pool;
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    BufferPool& Copier::getBufferPool()
+    {
+        if (!bufferPool_)
+            bufferPool_ = std::make_shared <BufferPool> (64 * 1024 * 1024);
+        return *bufferPool_;
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    void Copier::setParallelRanges(std::size_t count)
+    {
+        if (ranges_.empty())
+            rangeCount_ = std::max <std::size_t> (count, 1);
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    bool Copier::prepareRanges()
+    {
+        uint64_t const minimumRange = 64 * 1024 * 1024;
+        auto const remaining = totalFileSize_ - copiedBytes_;
+        auto const count = std::min <uint64_t> (rangeCount_, remaining / minimumRange);
+
+        if (count < 2 || sparse_ || fedExternally_ || engine_ == CopyEngine::IoUring ||
+            verification_ == Verification::Pending)
+        {
+            rangeCount_ = 1;
+            return false;
+        }
+
+        // the ranges write anywhere in the file, so it gets its final size up front.
+        if (!destination_.truncate(totalFileSize_))
+        {
+            rangeCount_ = 1;
+            return false;
+        }
+
+        auto const rangeSize = remaining / count;
+        for (uint64_t i = 0; i != count; ++i)
+        {
+            auto begin = copiedBytes_ + i * rangeSize;
+            ranges_.push_back(Range{begin, i + 1 == count ? totalFileSize_ : begin + rangeSize, CacheRelease{}});
+        }
+
+        getBufferPool(); // the range jobs must not race on creating it.
+
+        Log(LogSeverity::Debug, "Copying " + tempFile_ + " in " + std::to_string(count) + " ranges.");
+        return true;
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    void Copier::copyRanges(WorkStealingPool* executor)
+    {
+        std::vector <WorkStealingPool::JobType> jobs;
+        for (auto& i : ranges_)
+        {
+            if (i.offset == i.end)
+                continue;
+
+            auto* range = &i;
+            jobs.push_back([this, range]() {
+                auto requested = chunkSizeController_ ? chunkSizeController_->getChunkSize() : chunkSize_;
+                auto buffer = bufferPool_->acquire(std::min(requested, range->end - range->offset));
+                if (!buffer)
+                    return; // out of buffer memory, try again next pulse.
+
+                auto chunkStart = std::chrono::steady_clock::now();
+                auto transferred = source_.readAt(buffer.data(), buffer.size(), range->offset);
+                bool written = transferred > 0 && destination_.writeAt(buffer.data(), transferred, range->offset);
+
+                // may wait for the write back of the previous chunk, which must not hold up the other ranges.
+                if (written)
+                    releaseCache(range->release, range->offset, transferred);
+
+                std::lock_guard <std::mutex> guard(rangeLock_);
+                if (!written)
+                {
+                    illState_ = true; // 0 means the source shrank while copying, the copy is bogus.
+                    return;
+                }
+
+                if (chunkSizeController_)
+                    chunkSizeController_->report(requested, transferred, std::chrono::steady_clock::now() - chunkStart);
+
+                range->offset += transferred;
+                commitProgress(transferred);
+            });
+        }
+
+        if (executor != nullptr)
+            executor->run(jobs);
+        else
+            for (auto const& i : jobs)
+                i();
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    void Copier::releaseCache(CacheRelease& pending, uint64_t offset, uint64_t size)
+    {
+#ifdef __linux__
+        if (!largeFile_)
+            return;
+
+        // the source pages are clean and can go right away.
+        ::posix_fadvise(source_.descriptor(), static_cast <off_t> (offset), static_cast <off_t> (size), POSIX_FADV_DONTNEED);
+
+        // written pages can only be dropped once they are on the disk. Start the write back of this chunk now and
+        // drop the previous one, which had the time of a whole chunk to get there, so this rarely waits.
+        ::sync_file_range(destination_.descriptor(), static_cast <off64_t> (offset), static_cast <off64_t> (size),
+                          SYNC_FILE_RANGE_WRITE);
+        flushReleasedCache(pending);
+
+        pending.offset = offset;
+        pending.size = size;
+#else
+        (void)pending;
+        (void)offset;
+        (void)size;
+#endif
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    void Copier::flushReleasedCache(CacheRelease& pending)
+    {
+#ifdef __linux__
+        if (!largeFile_ || pending.size == 0)
+            return;
+
+        ::sync_file_range(destination_.descriptor(),
+                          static_cast <off64_t> (pending.offset), static_cast <off64_t> (pending.size),
+                          SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+        ::posix_fadvise(destination_.descriptor(),
+                        static_cast <off_t> (pending.offset), static_cast <off_t> (pending.size),
+                        POSIX_FADV_DONTNEED);
+        pending.size = 0;
+#else
+        (void)pending;
+#endif
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    uint64_t Copier::findNextData(uint64_t offset)
+    {
+        if (offset < dataEnd_)
+            return offset;
+
+        uint64_t begin;
+        uint64_t end;
+        if (!source_.findData(offset, begin, end))
+            begin = end = totalFileSize_;
+
+        // the source may have grown since it was opened, only the size we started with is copied.
+        begin = std::min(begin, totalFileSize_);
+        dataEnd_ = std::min(end, totalFileSize_);
+        return begin;
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    bool Copier::skipHole(uint64_t holeBegin, uint64_t dataBegin)
+    {
+        // the hole is recreated by not writing it. Extending the file right away keeps its size in line with the
+        // progress, which a checkpoint relies on, and produces the trailing hole of the file.
+        if (!destination_.truncate(dataBegin))
+            return false;
+
+        commitProgress(dataBegin - holeBegin);
+        return true;
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    void Copier::commitProgress(uint64_t bytes)
+    {
+        copiedBytes_ += bytes;
+
+        // checkpoint long copies now and then, so they survive a crash too.
+        // The data is synced first, a checkpoint must never be ahead of what is on the disk.
+        uint64_t const checkpointInterval = 256 * 1024 * 1024;
+        if (resumable_ && copiedBytes_ != totalFileSize_ && getContiguousProgress() - checkpointedBytes_ >= checkpointInterval)
+        {
+            if (destination_.sync())
+                writeCheckpoint();
+            else
+                illState_ = true;
+        }
+
+        if (durability_ != DurabilityPolicy::SyncPeriodically || syncInterval_ == 0)
+            return;
+
+        unsyncedBytes_ += bytes;
+        if (unsyncedBytes_ >= syncInterval_ && copiedBytes_ != totalFileSize_) // the last sync happens on close.
+        {
+            unsyncedBytes_ = 0;
+            if (!destination_.sync())
+                illState_ = true;
         }
     }
+//---------------------------------------------------------------------------------------------------------------------
+    void Copier::writeChunk(char const* data, uint64_t size)
+    {
+        if (!isGood() || isDone())
+            return;
+
+        if (preallocate_ && !preallocate())
+            return;
+
+        if (size > totalFileSize_ - copiedBytes_ || !destination_.write(data, size))
+        {
+            illState_ = true;
+            return;
+        }
+
+        if (verification_ == Verification::Pending)
+            sourceHash_.update(data, size);
+
+        releaseCache(pendingRelease_, copiedBytes_, size);
+        commitProgress(size);
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    void Copier::setFedExternally(bool fed)
+    {
+        if (fedExternally_ && !fed && !source_.seek(copiedBytes_))
+            illState_ = true;
+
+        asyncOffset_ = copiedBytes_;
+
+        fedExternally_ = fed;
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    bool Copier::isFedExternally() const
+    {
+        return fedExternally_;
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    void Copier::setAsyncRing(std::shared_ptr <IoRing> const& ring, std::size_t depth)
+    {
+        // completions arrive in any order, the hash needs the data in order.
+        if (!ring || !ring->good() || asyncInFlight_ > 0 || verification_ == Verification::Pending)
+            return;
+
+        ring_ = ring;
+        engine_ = CopyEngine::IoUring;
+        asyncOffset_ = copiedBytes_;
+
+        asyncChunks_.clear();
+        for (std::size_t i = 0; i != std::max <std::size_t> (depth, 1); ++i)
+        {
+            asyncChunks_.emplace_back(new AsyncChunk{BufferPool::Buffer{}, 0, 0, false, false, {}});
+            auto* chunk = asyncChunks_.back().get();
+            chunk->request.onComplete = [this, chunk](int32_t result) {
+                onAsyncComplete(*chunk, result);
+            };
+        }
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    void Copier::queueAsyncChunks()
+    {
+        for (auto& i : asyncChunks_)
+        {
+            if (asyncOffset_ >= totalFileSize_)
+                break;
+            if (i->busy)
+                continue;
+
+            if (sparse_)
+            {
+                auto dataBegin = findNextData(asyncOffset_);
+                if (dataBegin != asyncOffset_)
+                {
+                    // holes are committed ahead of the chunks still in flight, which is fine,
+                    // because checkpoints only use the contiguous progress.
+                    auto holeBegin = asyncOffset_;
+                    asyncOffset_ = dataBegin;
+                    if (!skipHole(holeBegin, dataBegin))
+                    {
+                        illState_ = true;
+                        return;
+                    }
+                    if (asyncOffset_ >= totalFileSize_)
+                        break;
+                }
+            }
+
+            auto size = std::min(chunkSize_, (sparse_ ? dataEnd_ : totalFileSize_) - asyncOffset_);
+            i->buffer = getBufferPool().acquire(size);
+            if (!i->buffer)
+                break; // out of buffer memory, try again next pulse.
+
+            i->offset = asyncOffset_;
+            i->size = static_cast <uint32_t> (i->buffer.size());
+            i->writing = false;
+            if (!ring_->queueRead(source_.descriptor(), i->buffer.data(), i->size, i->offset, &i->request))
+            {
+                i->buffer.release();
+                break; // ring is at capacity, try again next pulse.
+            }
+
+            i->busy = true;
+            ++asyncInFlight_;
+            asyncOffset_ += i->size;
+        }
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    void Copier::onAsyncComplete(AsyncChunk& chunk, int32_t result)
+    {
+        // short transfers on regular files mean, that the source shrank or the destination is full.
+        if (result < 0 || static_cast <uint32_t> (result) != chunk.size)
+            illState_ = true;
+
+        if (!illState_ && !chunk.writing)
+        {
+            chunk.writing = true;
+            // the completion just freed a slot, so this cannot fail for lack of capacity.
+            if (ring_->queueWrite(destination_.descriptor(), chunk.buffer.data(), chunk.size, chunk.offset, &chunk.request))
+                return;
+            illState_ = true;
+        }
+        else if (!illState_)
+        {
+            releaseCache(pendingRelease_, chunk.offset, chunk.size);
+            commitProgress(chunk.size);
+        }
+
+        chunk.buffer.release();
+        chunk.busy = false;
+        --asyncInFlight_;
+    }
 //#####################################################################################################################
 }
@@ -1,28 +1,172 @@
 #pragma once
 
+#include "native_file.hpp"
+#include "io_ring.hpp"
+#include "chunk_size_controller.hpp"
+#include "buffer_pool.hpp"
+#include "content_hash.hpp"
+#include "work_stealing_pool.hpp"
+
 #include <string>
-#include <fstream>
 #include <vector>
+#include <memory>
+#include <mutex>
 #include <cstdint>
 
 namespace FileSpreader
 {
+    /**
+     *  The way bytes are moved from source to destination.
+     *  Kernel side transfers are tried first and the copier degrades, if the system refuses them.
+     */
+    enum class CopyEngine
+    {
+        Clone, // linux only, the destination shares the extents of the source (reflink), whole file at once.
+        CopyFileRange, // linux only, in kernel, possibly offloaded to the file system.
+        SendFile, // linux only, in kernel.
+        Buffered, // read / write through a user space buffer.
+        IoUring // linux only, asynchronous positional reads and writes on an IoRing shared with other copiers.
+    };
+
+    /**
+     *  How hard a copier tries to get the data onto the disk before the file is renamed into place.
+     */
+    enum class DurabilityPolicy
+    {
+        None, // leave it to the operating system.
+        SyncOnClose, // sync the file before the rename and the directory after it.
+        SyncPeriodically // like SyncOnClose, but additionally sync every n written bytes.
+    };
+
+    /**
+     *  The outcome of verifying a copy against its source.
+     */
+    enum class Verification
+    {
+        Off,
+        Pending, // hashing while copying, then reading the destination back.
+        Verified,
+        Mismatch,
+        Unverifiable // resumed, sparse or asynchronous copies, not all data passes through the copier.
+    };
+
     class Copier
     {
     public:
+        /**
+         *  @param resumable Keep the temporary file and a checkpoint next to it, if the copy is interrupted,
+         *                   and continue from a matching checkpoint instead of starting over.
+         *  @param anonymousTempFile Write into an unnamed file (O_TMPFILE), that is linked into place when done.
+         *                           It is never visible and vanishes by itself, if the copy is interrupted.
+         *                           Not used for resumable copies. Falls back to a named file where unsupported.
+         */
         Copier(std::string const& source, std::string const& destination, bool useArchiveBit,
-               std::string const& tempPostfix, uint64_t chunkSize = 1 * 1024 * 1024 /* 1 MB */);
+               std::string const& tempPostfix, uint64_t chunkSize = 1 * 1024 * 1024 /* 1 MB */,
+               bool resumable = false, bool anonymousTempFile = false);
         ~Copier();
         Copier(Copier const&) = delete;
         Copier& operator=(Copier const&) = delete;
 
         bool isGood() const;
+
+        /**
+         *  Returns true, once all bytes are copied and, if verifying, the destination matched.
+         */
         bool isDone() const;
 
         uint64_t getProgress() const;
         uint64_t getProgressMax() const;
 
-        void copyChunk();
+        /**
+         *  Copies the next chunk. A copy split into ranges copies a chunk of every range,
+         *  in parallel if an executor is given.
+         */
+        void copyChunk(WorkStealingPool* executor = nullptr);
+
+        /**
+         *  Returns the engine that is currently used to move bytes.
+         */
+        CopyEngine getEngine() const;
+
+        /**
+         *  Writes bytes that were read elsewhere, for instance by a FanOutCopier that reads the source only once.
+         *  The data must continue exactly at getProgress().
+         */
+        void writeChunk(char const* data, uint64_t size);
+
+        /**
+         *  A copier that is fed externally does not read its source and must not be pulsed with copyChunk.
+         *  Turning feeding off positions the source at the current progress, so copyChunk can take over.
+         */
+        void setFedExternally(bool fed);
+        bool isFedExternally() const;
+
+        /**
+         *  Moves this copy onto an asynchronous ring. copyChunk then only queues up to "depth" chunks,
+         *  which complete whenever the ring is pumped. The ring must be pumped by the thread pulsing this copier.
+         */
+        void setAsyncRing(std::shared_ptr <IoRing> const& ring, std::size_t depth = 8);
+
+        /**
+         *  Sets the durability policy. The sync interval is only used by DurabilityPolicy::SyncPeriodically.
+         */
+        void setDurability(DurabilityPolicy policy, uint64_t syncInterval = 64 * 1024 * 1024 /* 64 MB */);
+
+        /**
+         *  Lets the controller decide the chunk size of the synchronous engines, instead of the fixed size
+         *  passed to the constructor. Every chunk is reported back to it.
+         */
+        void setChunkSizeController(std::shared_ptr <ChunkSizeController> const& controller);
+
+        /**
+         *  Allows cloning the file on copy on write file systems (btrfs, XFS with reflink), before falling back to
+         *  copying the bytes. Only tried once, on the first copyChunk of a copy that did not start yet. Default on.
+         */
+        void setUseReflink(bool useReflink);
+
+        /**
+         *  Tries the clone right away instead of on the first copyChunk, for a copy about to be fed externally.
+         *  Returns true, if the copy needs no data anymore (cloned or ill).
+         */
+        bool tryCloneNow();
+
+        /**
+         *  Files of at least "threshold" bytes are copied without polluting the page cache: Every chunk is dropped
+         *  from the cache once it was written, so copying huge files does not evict what other processes need.
+         *  0 = never. Only effective on linux.
+         */
+        void setLargeFileThreshold(uint64_t threshold);
+
+        /**
+         *  Takes the buffers of the buffered and the asynchronous engine from a pool shared with other copiers.
+         *  Buffers are only held while a chunk is in transit. If the pool is exhausted, the copy waits for the next pulse.
+         *  Without a shared pool, the copier has a small one of its own.
+         */
+        void setBufferPool(std::shared_ptr <BufferPool> const& pool);
+
+        /**
+         *  Splits the copy into "count" ranges, that are copied concurrently with positional reads and writes
+         *  into the temporary file, which is extended to its final size first. Pays off on storage that needs
+         *  several requests in flight to reach its speed (striped, NVMe), not on a single spinning disk.
+         *  Not used for sparse files or asynchronous copies, or if each range would be less than 64 MB.
+         */
+        void setParallelRanges(std::size_t count);
+
+        /**
+         *  Hashes every chunk as it passes through the copier and, once the copy is complete, reads the destination
+         *  back chunk by chunk with further copyChunk calls. A mismatching copy is discarded.
+         *  The read back is a second full pass: Every verified copy is read from the destination once more.
+         *  Verifying copies use the buffered engine, because kernel side transfers never show the data.
+         *  Clones share the extents of the source and count as verified. Must be called before setAsyncRing.
+         *  The read back sees what the file system returns, which can be the page cache without a durability policy.
+         */
+        void setVerify(bool verify);
+        Verification getVerification() const;
+
+        /**
+         *  Returns the bytes of the destination that were read back for the verification.
+         */
+        uint64_t getVerifiedBytes() const;
 
         std::string getDestinationFile() const;
         std::string getSourceFile() const;
@@ -31,16 +175,97 @@ namespace FileSpreader
         static bool testFileAccess(std::string const& source, std::string const& destination,
                                    std::string const& tempPostfix, bool deleteAfterTest = false);
 
+    private:
+        /**
+         *  A written part of the destination, that is dropped from the cache after the next chunk.
+         */
+        struct CacheRelease
+        {
+            uint64_t offset = 0;
+            uint64_t size = 0;
+        };
+
+        struct Range
+        {
+            uint64_t offset; // next byte to copy
+            uint64_t end;
+            CacheRelease release; // only touched by the job of this range.
+        };
+
+        struct AsyncChunk
+        {
+            BufferPool::Buffer buffer; // only held while busy.
+            uint64_t offset;
+            uint32_t size;
+            bool busy;
+            bool writing;
+            IoRequest request;
+        };
+
+        void commitProgress(uint64_t bytes);
+        bool tryClone();
+        bool preallocate();
+        bool linkTempFile();
+        void verifyChunk();
+        uint64_t findNextData(uint64_t offset);
+        bool skipHole(uint64_t holeBegin, uint64_t dataBegin);
+        void releaseCache(CacheRelease& pending, uint64_t offset, uint64_t size);
+        bool prepareRanges();
+        void copyRanges(WorkStealingPool* executor);
+        BufferPool& getBufferPool();
+        void flushReleasedCache(CacheRelease& pending);
+        bool tryResume();
+        void writeCheckpoint();
+        void removeCheckpoint();
+        uint64_t getContiguousProgress() const;
+        void queueAsyncChunks();
+        void onAsyncComplete(AsyncChunk& chunk, int32_t result);
+
     private:
         std::string actualFile_;
         std::string tempFile_;
+        std::string checkpointFile_;
+        std::string pendingCheckpointFile_;
         std::string sourceFileName_;
-        std::ifstream source_;
-        std::ofstream destination_;
-        std::vector <char> buffer_;
+        NativeFile source_;
+        NativeFile destination_;
+        std::shared_ptr <BufferPool> bufferPool_;
+        uint64_t chunkSize_;
+        CopyEngine engine_;
         uint64_t copiedBytes_;
         uint64_t totalFileSize_;
+        int64_t sourceModified_; // when the copy started, the finished copy is stamped with it.
         bool illState_;
         bool useArchiveBit_;
+        bool fedExternally_;
+        bool resumable_;
+        bool anonymous_; // the temporary file has no name, until linkTempFile.
+        bool tryClone_; // cleared after the first attempt.
+        bool preallocate_; // pending until the first byte is written.
+        bool sparse_; // the source has holes, only its data extents are copied.
+        uint64_t dataEnd_; // end of the source data extent last found by findNextData.
+        bool largeFile_; // keep the page cache clean.
+        CacheRelease pendingRelease_; // of the sequential copy, the ranges have their own.
+
+        Verification verification_;
+        ContentHash sourceHash_; // of everything written to the destination.
+        ContentHash destinationHash_; // of what was read back.
+        uint64_t verifiedBytes_;
+        NativeFile readBack_;
+
+        std::size_t rangeCount_;
+        std::vector <Range> ranges_; // empty, until the ranged copy starts.
+        std::mutex rangeLock_; // guards the progress and state while ranges are copied.
+
+        uint64_t checkpointedBytes_;
+        DurabilityPolicy durability_;
+        uint64_t syncInterval_;
+        uint64_t unsyncedBytes_;
+        std::shared_ptr <ChunkSizeController> chunkSizeController_;
+
+        std::shared_ptr <IoRing> ring_;
+        std::vector <std::unique_ptr <AsyncChunk>> asyncChunks_;
+        std::size_t asyncInFlight_;
+        uint64_t asyncOffset_; // next offset to be read asynchronously
     };
 }
@@ -1,24 +1,97 @@
 #include "directory_scanner.hpp"
 #include "archive_bit.hpp"
+#include "content_hash.hpp"
+#include "native_file.hpp"
 #include "log.hpp"
 
+#include <sys/stat.h>
+
 #include <algorithm>
+#include <cstdlib>
+#include <iomanip>
 #include <iterator>
+#include <sstream>
 #include <boost/filesystem.hpp>
+#include <boost/optional.hpp>
 
 namespace FileSpreader
 {
 //#####################################################################################################################
     namespace fs = boost::filesystem;
+//#####################################################################################################################
+    namespace
+    {
+        enum class EntryType
+        {
+            File,
+            Directory,
+            Other
+        };
+
+        /**
+         *  One stat tells the type and fills the metadata of a file.
+         */
+        EntryType readEntry(fs::path const& path, FileMetadata& metadata)
+        {
+#ifdef _WIN32
+            boost::system::error_code ec;
+            auto status = fs::status(path, ec);
+            if (fs::is_directory(status))
+                return EntryType::Directory;
+            if (!fs::is_regular_file(status))
+                return EntryType::Other;
+
+            metadata.size = fs::file_size(path, ec);
+            metadata.modified = static_cast <int64_t> (fs::last_write_time(path, ec)) * 1'000'000'000;
+            metadata.inode = 0;
+            return EntryType::File;
+#else
+            struct stat st;
+            if (::stat(path.c_str(), &st) != 0)
+                return EntryType::Other;
+            if (S_ISDIR(st.st_mode))
+                return EntryType::Directory;
+            if (!S_ISREG(st.st_mode))
+                return EntryType::Other;
+
+            metadata.size = st.st_size;
+#   ifdef __APPLE__
+            metadata.modified = static_cast <int64_t> (st.st_mtimespec.tv_sec) * 1'000'000'000 + st.st_mtimespec.tv_nsec;
+#   else
+            metadata.modified = static_cast <int64_t> (st.st_mtim.tv_sec) * 1'000'000'000 + st.st_mtim.tv_nsec;
+#   endif
+            metadata.inode = st.st_ino;
+            return EntryType::File;
+#endif
+        }
+
+        std::string indexFileName(std::string const& indexDirectory, std::string const& directory, bool filtered)
+        {
+            // a source can be the destination of another task, but its list is filtered.
+            auto key = directory + (filtered ? "|filtered" : "");
+            ContentHash hash;
+            hash.update(key.data(), key.size());
+
+            std::ostringstream name;
+            name << std::hex << std::setw(16) << std::setfill('0') << hash.digest() << ".index";
+            return (fs::path(indexDirectory) / name.str()).string();
+        }
+    }
 //#####################################################################################################################
     DirectoryScanner::DirectoryScanner(std::string directory, ClonerOptions options, bool filtered)
         : sourceDirectory_{std::move(directory)}
-        , scannerIterator_{}
+        , pendingDirectories_{}
         , options_{std::move(options)}
         , filtered_{filtered}
-        , differenceProgress_{-1}
+        , differenceProgress_{}
         , list_{}
-        , sievedList_{}
+        , directories_{}
+        , indexFile_{}
+        , indexDirty_{false}
+        , rescan_{}
+        , directoryListener_{}
+        , pendingHashes_{}
+        , hashesQueued_{}
     {
         if (fs::exists(sourceDirectory_) && !fs::is_directory(sourceDirectory_))
         {
@@ -27,6 +100,12 @@ namespace FileSpreader
         }
 
         reset();
+
+        if (!options_.getIndexDirectory().empty())
+        {
+            indexFile_ = indexFileName(options_.getIndexDirectory(), sourceDirectory_, filtered_);
+            loadIndex();
+        }
     }
 //---------------------------------------------------------------------------------------------------------------------
     DirectoryScanner::~DirectoryScanner() = default;
@@ -43,15 +122,24 @@ namespace FileSpreader
 //---------------------------------------------------------------------------------------------------------------------
     void DirectoryScanner::reset()
     {
+        metadata_.clear();
         list_.clear();
+        directories_.clear();
         filesScanned_ = 0;
-        differenceProgress_ = -1;
-        scannerIterator_ = fs::recursive_directory_iterator{sourceDirectory_};
+        differenceProgress_.clear();
+        rescan_.reset();
+        pendingHashes_.clear();
+        hashesQueued_.clear();
+        indexDirty_ = false;
+        if (directoryListener_)
+            directoryListener_(sourceDirectory_);
+        pendingDirectories_.clear();
+        pendingDirectories_.push_back(PendingDirectory{sourceDirectory_, {}, false});
     }
 //---------------------------------------------------------------------------------------------------------------------
     bool DirectoryScanner::finished() const
     {
-        return (scannerIterator_ == fs::recursive_directory_iterator{});
+        return pendingDirectories_.empty();
     }
 //---------------------------------------------------------------------------------------------------------------------
     uint64_t DirectoryScanner::getFileCount() const
@@ -59,7 +147,7 @@ namespace FileSpreader
         return filesScanned_;
     }
 //---------------------------------------------------------------------------------------------------------------------
-    int DirectoryScanner::scan(int amount)
+    int DirectoryScanner::scan(int amount, WorkStealingPool* executor)
     {
         using namespace std::string_literals;
 
@@ -74,35 +162,447 @@ namespace FileSpreader
             throw std::runtime_error("Cannot find nor create the assigned directory");
         }
 
-        auto basePathLen = sourceDirectory_.length();
-        auto& opts = options_.getDestinationOptions(sourceDirectory_);
-        auto suffixFilter = WildcardFilter{"*"s + options_.getTempSuffix()};
-        auto end = fs::recursive_directory_iterator{};
-        auto i = 0;
+        // one directory per job, what is left of the amount is shared among them, round after round.
+        std::size_t const parallel = executor != nullptr ? std::max <std::size_t> (executor->getThreadCount(), 1) : 1;
+        int scanned = 0;
+
+        while (scanned < amount && !pendingDirectories_.empty())
+        {
+            std::vector <PendingDirectory> taken;
+            while (!pendingDirectories_.empty() && taken.size() < parallel)
+            {
+                taken.push_back(std::move(pendingDirectories_.front()));
+                pendingDirectories_.pop_front();
+            }
+            int const quota = std::max(1, (amount - scanned) / static_cast <int> (taken.size()));
+
+            std::vector <Listing> listings(taken.size());
+            if (executor != nullptr && taken.size() > 1)
+            {
+                std::vector <WorkStealingPool::JobType> jobs;
+                for (std::size_t i = 0; i != taken.size(); ++i)
+                {
+                    jobs.push_back([this, &taken, &listings, i, quota]() {
+                        listDirectory(taken[i], quota, listings[i]);
+                    });
+                }
+                executor->run(jobs);
+            }
+            else
+            {
+                for (std::size_t i = 0; i != taken.size(); ++i)
+                    listDirectory(taken[i], quota, listings[i]);
+            }
+
+            // unfinished directories are continued first, new ones wait at the back.
+            for (std::size_t i = taken.size(); i != 0; --i)
+                if (!listings[i - 1].done)
+                    pendingDirectories_.push_front(std::move(taken[i - 1]));
+
+            for (auto& listing : listings)
+            {
+                scanned += listing.entries;
+                for (auto& file : listing.files)
+                {
+                    // check for filters, and if not filtered, add it to the set.
+                    if (!isFiltered(file.first))
+                        metadata_[&*list_.insert(std::move(file.first)).first] = file.second;
+
+                    ++filesScanned_;
+                }
+                for (auto& directory : listing.directories)
+                {
+                    auto path = sourceDirectory_ + directory.first;
+                    directories_.insert(std::move(directory.first));
+                    if (!directory.second)
+                        continue;
+
+                    // watched before its content is read.
+                    if (directoryListener_)
+                        directoryListener_(path);
+                    pendingDirectories_.push_back(PendingDirectory{std::move(path), {}, false});
+                }
+            }
+        }
+
+        if (finished())
+            saveIndex();
 
-        for (; scannerIterator_ != end && i != amount; ++i, ++scannerIterator_)
+        return scanned;
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    void DirectoryScanner::listDirectory(PendingDirectory& directory, int quota, Listing& listing) const
+    {
+        boost::system::error_code ec;
+        if (!directory.opened)
         {
-            if (fs::is_regular_file(scannerIterator_->path()))
+            directory.opened = true;
+            directory.position = fs::directory_iterator{directory.path, ec};
+            if (ec)
             {
-                // relative path from source_
-                auto pathString = scannerIterator_->path().string();
-                pathString.erase(0, basePathLen);
+                Log(LogSeverity::Warning, "Cannot list " + directory.path + ": " + ec.message(), LOG_CODE_PLACE);
+                listing.done = true;
+                return;
+            }
+        }
 
-                // check for filters, and if not filtered, add it to the set.
-                if (!filtered_ || !opts.filtered(pathString, &suffixFilter))
-                    list_.insert(pathString);
+        auto const basePathLen = sourceDirectory_.length();
+        auto const end = fs::directory_iterator{};
+        while (directory.position != end && listing.entries != quota)
+        {
+            auto const& path = directory.position->path();
+
+            FileMetadata metadata;
+            auto type = readEntry(path, metadata);
+            if (type == EntryType::File)
+            {
+                listing.files.emplace_back(path.string().substr(basePathLen), metadata);
+            }
+            else if (type == EntryType::Directory)
+            {
+                // like with the recursive iterator before, links to directories are listed, but not followed.
+                boost::system::error_code linkEc;
+                auto descend = !fs::is_symlink(directory.position->symlink_status(linkEc));
+                listing.directories.emplace_back(path.string().substr(basePathLen), descend);
+            }
 
-                ++filesScanned_;
+            ++listing.entries;
+            directory.position.increment(ec);
+            if (ec)
+            {
+                Log(LogSeverity::Warning, "Cannot list " + directory.path + ": " + ec.message(), LOG_CODE_PLACE);
+                directory.position = end;
             }
         }
-        return i;
+        listing.done = directory.position == end;
     }
 //---------------------------------------------------------------------------------------------------------------------
     DirectoryScanner::PathContainerType* DirectoryScanner::getList()
     {
-        sievedList_ = list_;
-        return &sievedList_;
+        // the difference extractors only read the list, no need for a copy per destination.
+        return &list_;
     }
+//---------------------------------------------------------------------------------------------------------------------
+    DirectoryScanner::PathContainerType const& DirectoryScanner::getDirectories() const
+    {
+        return directories_;
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    FileMetadata const* DirectoryScanner::getMetadata(std::string const& listedFile) const
+    {
+        auto metadata = metadata_.find(&listedFile);
+        if (metadata == std::end(metadata_))
+            return nullptr;
+        return &metadata->second;
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    FileMetadata const* DirectoryScanner::findMetadata(std::string const& file) const
+    {
+        auto listed = list_.find(file);
+        if (listed == std::end(list_))
+            return nullptr;
+        return getMetadata(*listed);
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    bool DirectoryScanner::hasChanged(std::string const& file, DirectoryScanner const& other, std::string const& otherFile,
+                                      ComparisonPolicy policy, int64_t timeWindow) const
+    {
+        if (policy == ComparisonPolicy::Path)
+            return false;
+
+        auto const* metadata = getMetadata(file);
+        auto const* otherMetadata = other.getMetadata(otherFile);
+        if (metadata == nullptr || otherMetadata == nullptr)
+            return false;
+
+        if (metadata->size != otherMetadata->size)
+            return true;
+
+        // copies carry the time of their source, any other time is another version, older or not.
+        if (policy == ComparisonPolicy::SizeAndTime)
+            return std::abs(metadata->modified - otherMetadata->modified) > timeWindow;
+
+        auto hash = getHash(file);
+        auto otherHash = other.getHash(otherFile);
+        return !hash || !otherHash || hash.get() != otherHash.get();
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    boost::optional <uint64_t> DirectoryScanner::getHash(std::string const& listedFile) const
+    {
+        auto const* metadata = getMetadata(listedFile);
+        if (metadata == nullptr || !metadata->hashed)
+            return boost::none;
+        return metadata->hash;
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    void DirectoryScanner::queueHash(std::string const& listedFile)
+    {
+        // a source is compared to every destination, but only read once. The hash is kept in the index.
+        auto metadata = metadata_.find(&listedFile);
+        if (metadata == std::end(metadata_) || metadata->second.hashed || !hashesQueued_.insert(&listedFile).second)
+            return;
+
+        pendingHashes_.push_back(PendingHash{&listedFile, metadata->second.size, {}, ContentHash{}, 0, false, false, false});
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    bool DirectoryScanner::hashQueued(uint64_t byteBudget, WorkStealingPool* executor)
+    {
+        // one file per job, what is left of the budget is shared among them, round after round.
+        std::size_t const parallel = executor != nullptr ? std::max <std::size_t> (executor->getThreadCount(), 1) : 1;
+        uint64_t spent = 0;
+
+        while (spent < byteBudget && !pendingHashes_.empty())
+        {
+            std::vector <PendingHash> taken;
+            while (!pendingHashes_.empty() && taken.size() < parallel)
+            {
+                taken.push_back(std::move(pendingHashes_.front()));
+                pendingHashes_.pop_front();
+            }
+            uint64_t const quota = std::max <uint64_t> (1, (byteBudget - spent) / taken.size());
+
+            std::vector <uint64_t> read(taken.size(), 0);
+            if (executor != nullptr && taken.size() > 1)
+            {
+                std::vector <WorkStealingPool::JobType> jobs;
+                for (std::size_t i = 0; i != taken.size(); ++i)
+                {
+                    jobs.push_back([this, &taken, &read, i, quota]() {
+                        read[i] = hashFile(taken[i], quota);
+                    });
+                }
+                executor->run(jobs);
+            }
+            else
+            {
+                for (std::size_t i = 0; i != taken.size(); ++i)
+                    read[i] = hashFile(taken[i], quota);
+            }
+
+            // unfinished files are continued first.
+            for (std::size_t i = taken.size(); i != 0; --i)
+            {
+                auto& pending = taken[i - 1];
+                spent += read[i - 1];
+                if (!pending.done)
+                {
+                    pendingHashes_.push_front(std::move(pending));
+                    continue;
+                }
+
+                // an unreadable file stays without a hash and counts as changed.
+                hashesQueued_.erase(pending.file);
+                auto metadata = metadata_.find(pending.file);
+                if (pending.failed || metadata == std::end(metadata_))
+                    continue;
+
+                metadata->second.hash = pending.hash.digest();
+                metadata->second.hashed = true;
+                indexDirty_ = true;
+            }
+        }
+
+        return pendingHashes_.empty();
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    uint64_t DirectoryScanner::hashFile(PendingHash& pending, uint64_t quota) const
+    {
+        if (!pending.opened)
+        {
+            pending.opened = true;
+            pending.input = NativeFile(sourceDirectory_ + *pending.file, FileOpenMode::Read);
+            if (!pending.input.good())
+            {
+                pending.failed = pending.done = true;
+                return 0;
+            }
+        }
+
+        // sized for the file as scanned, small files are common. One more byte finds the end in the same read.
+        auto const bufferSize = std::min <uint64_t> (1024 * 1024, std::max <uint64_t> (pending.size - std::min(pending.offset, pending.size) + 1, 4096));
+        std::vector <char> buffer(bufferSize);
+
+        uint64_t total = 0;
+        while (total < quota)
+        {
+            auto read = pending.input.readAt(buffer.data(), std::min <uint64_t> (buffer.size(), quota - total + 1), pending.offset);
+            if (read <= 0)
+            {
+                pending.failed = read < 0;
+                pending.done = true;
+                pending.input.close();
+                break;
+            }
+            pending.hash.update(buffer.data(), read);
+            pending.offset += read;
+            total += read;
+        }
+        return total;
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    bool DirectoryScanner::isProvisional() const
+    {
+        return static_cast <bool> (rescan_);
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    int DirectoryScanner::rescan(int amount, WorkStealingPool* executor)
+    {
+        if (!rescan_)
+            return 0;
+        return rescan_->scan(amount, executor);
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    bool DirectoryScanner::rescanFinished() const
+    {
+        return !rescan_ || rescan_->finished();
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    void DirectoryScanner::adoptRescan()
+    {
+        if (!rescan_ || !rescan_->finished())
+            return;
+
+        auto fresh = std::move(rescan_);
+
+        // hashing reads the whole file, keep the hashes and verifications of files that are still the same.
+        for (auto& i : fresh->metadata_)
+        {
+            auto previous = list_.find(*i.first);
+            if (previous == std::end(list_))
+                continue;
+
+            auto old = metadata_.find(&*previous);
+            if (old == std::end(metadata_) || (!old->second.hashed && !old->second.verified))
+                continue;
+
+            if (old->second.size == i.second.size &&
+                old->second.modified == i.second.modified &&
+                old->second.inode == i.second.inode)
+            {
+                i.second.hash = old->second.hash;
+                i.second.hashed = old->second.hashed;
+                i.second.verified = old->second.verified;
+            }
+        }
+
+        // queued hashes refer to the old list.
+        pendingHashes_.clear();
+        hashesQueued_.clear();
+
+        // moving the sets keeps their elements where they are, so the metadata stays valid.
+        list_ = std::move(fresh->list_);
+        directories_ = std::move(fresh->directories_);
+        metadata_ = std::move(fresh->metadata_);
+        filesScanned_ = fresh->filesScanned_;
+        differenceProgress_.clear();
+
+        saveIndex();
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    bool DirectoryScanner::recordFile(std::string const& fileName, bool verified)
+    {
+        if (fileName.compare(0, sourceDirectory_.length(), sourceDirectory_) != 0)
+            return false;
+
+        auto relativeFile = fileName.substr(sourceDirectory_.length());
+        if (isFiltered(relativeFile))
+            return false;
+
+        FileMetadata metadata;
+        if (readEntry(fileName, metadata) != EntryType::File)
+            return false;
+        metadata.verified = verified;
+
+        auto inserted = list_.insert(relativeFile);
+        metadata_[&*inserted.first] = metadata;
+        if (inserted.second)
+            ++filesScanned_;
+        indexDirty_ = true;
+
+        // a hash begun before would mix both versions.
+        if (hashesQueued_.erase(&*inserted.first) != 0)
+        {
+            pendingHashes_.erase(std::remove_if(std::begin(pendingHashes_), std::end(pendingHashes_), [&](auto const& pending) {
+                return pending.file == &*inserted.first;
+            }), std::end(pendingHashes_));
+        }
+
+        if (rescan_)
+            rescan_->recordFile(fileName, verified);
+        return true;
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    void DirectoryScanner::setDirectoryListener(std::function <void(std::string const& directory)> const& listener)
+    {
+        directoryListener_ = listener;
+        if (rescan_)
+            rescan_->setDirectoryListener(listener);
+
+        if (!directoryListener_)
+            return;
+
+        directoryListener_(sourceDirectory_);
+        for (auto const& i : directories_)
+            directoryListener_(sourceDirectory_ + i);
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    bool DirectoryScanner::isFiltered(std::string const& relativeFile)
+    {
+        if (!filtered_)
+            return false;
+
+        // named temporary files are never copied, whoever left them here: another task writing into this
+        // directory, a crash or this one, when anonymous ones are not available. A plain compare, this runs per file.
+        auto const& suffix = options_.getTempSuffix();
+        if (!suffix.empty() && relativeFile.size() >= suffix.size() &&
+            relativeFile.compare(relativeFile.size() - suffix.size(), suffix.size(), suffix) == 0)
+            return true;
+
+        return options_.getDestinationOptions(sourceDirectory_).filtered(relativeFile, nullptr);
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    void DirectoryScanner::flushIndex()
+    {
+        if (indexDirty_)
+            saveIndex();
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    void DirectoryScanner::loadIndex()
+    {
+        ScanIndex index;
+        if (!index.open(indexFile_, sourceDirectory_))
+            return;
+
+        // the index is sorted like the list, every element goes to the end.
+        metadata_.reserve(index.getFileCount());
+        for (uint64_t i = 0; i != index.getFileCount(); ++i)
+        {
+            auto file = list_.emplace_hint(std::end(list_), index.getFile(i));
+            metadata_[&*file] = index.getMetadata(i);
+        }
+        for (uint64_t i = 0; i != index.getDirectoryCount(); ++i)
+            directories_.emplace_hint(std::end(directories_), index.getDirectory(i));
+        filesScanned_ = list_.size();
+
+        // the list is used right away. The walk that verifies it fills a scanner of its own.
+        auto rescanOptions = options_;
+        rescanOptions.setIndexDirectory({});
+        rescan_.reset(new DirectoryScanner(sourceDirectory_, rescanOptions, filtered_));
+        pendingDirectories_.clear();
+
+        Log(LogSeverity::Info, "Loaded " + std::to_string(list_.size()) + " files of " + sourceDirectory_ + " from the scan index.");
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    void DirectoryScanner::saveIndex()
+    {
+        if (indexFile_.empty())
+            return;
+
+        boost::system::error_code ec;
+        fs::create_directories(fs::path(indexFile_).parent_path(), ec);
+        if (ScanIndex::write(indexFile_, sourceDirectory_, list_, metadata_, directories_))
+            indexDirty_ = false;
+    }
 //---------------------------------------------------------------------------------------------------------------------
     bool DirectoryScanner::findDifference(
         SymmetricDifferenceExtractor <PathContainerType::iterator>& differenceFinder,
@@ -112,33 +612,26 @@ namespace FileSpreader
     {
         using namespace std::string_literals;
 
-        if (differenceProgress_ == -1)
-        {
-            bool done = differenceFinder.workLeftOnly(amount);
-
-            if (!done)
-                return true;
-            else
-                differenceProgress_ = 0;
-        }
+        // one scanner is the source of several differences, each has its own progress.
+        if (!differenceFinder.workLeftOnly(amount))
+            return true;
 
         if (options_.isUsingArchiveBit())
         {
+            auto& progress = differenceProgress_[&differenceFinder];
+            if (progress == -1)
+                return false;
+
             int scaledAmount = amount/40;
             if (scaledAmount < 1)
                 scaledAmount = 1;
 
             auto& uni = *differenceFinder.getUnion();
-            auto end = std::begin(uni) + differenceProgress_ + scaledAmount;
-            bool done = false;
-            if (end >= std::end(uni))
-            {
-                end = std::end(uni);
-                done = true;
-            }
+            auto end = std::begin(uni) + std::min <std::size_t> (progress + scaledAmount, uni.size());
+            bool done = end == std::end(uni);
 
             auto cutOffBegin = std::remove_if(
-                std::begin(uni) + differenceProgress_,
+                std::begin(uni) + progress,
                 end,
                 [this](auto const& elem)
                 {
@@ -148,10 +641,10 @@ namespace FileSpreader
 
             int notDeletedAmount = cutOffBegin - std::begin(uni);
             uni.erase(cutOffBegin, end);
-            differenceProgress_ = notDeletedAmount;
+            progress = notDeletedAmount;
 
             if (done)
-                differenceProgress_ = -1;
+                progress = -1;
 
             return !done;
         }
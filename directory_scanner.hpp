@@ -1,13 +1,22 @@
 #pragma once
 
 #include "cloner_options.hpp"
+#include "content_hash.hpp"
+#include "native_file.hpp"
+#include "scan_index.hpp"
 #include "set_symmetry.hpp"
+#include "work_stealing_pool.hpp"
 
 #include <boost/filesystem.hpp>
+#include <boost/optional.hpp>
 
+#include <deque>
+#include <functional>
+#include <map>
 #include <vector>
 #include <string>
 #include <memory>
+#include <unordered_set>
 
 namespace FileSpreader
 {
@@ -17,9 +26,19 @@ namespace FileSpreader
         using PathContainerType = std::set <std::string>;
 
     public:
+        /**
+         *  With an index directory in the options, the list of the last finished scan is loaded from there and
+         *  the scanner starts out finished. Such a list is provisional, see rescan.
+         */
         DirectoryScanner(std::string directory, ClonerOptions options, bool filtered = false);
         ~DirectoryScanner();
 
+        // the metadata refers to the elements of the list by address, a copy would point into the original.
+        DirectoryScanner(DirectoryScanner&&) = default;
+        DirectoryScanner& operator=(DirectoryScanner&&) = default;
+        DirectoryScanner(DirectoryScanner const&) = delete;
+        DirectoryScanner& operator=(DirectoryScanner const&) = delete;
+
         /**
          *  Set options.
          *  Please note that filters will not apply retroactively to the already made list.
@@ -40,10 +59,12 @@ namespace FileSpreader
 
         /**
          *  Scans over the directory for some more files.
+         *  With an executor, up to one directory per thread is listed at once, so file systems with a high latency
+         *  per request (network shares) have many of them in flight. Either way, at most "amount" entries are read.
          *
          *  @return Returns the amount of files scanned.
          */
-        int scan(int amount = 8192);
+        int scan(int amount = 8192, WorkStealingPool* executor = nullptr);
 
         /**
          *  Returns the amount of files that were found.
@@ -75,15 +96,161 @@ namespace FileSpreader
 
         PathContainerType* getList();
 
+        /**
+         *  Returns the directories found so far, relative like the files. The scanned directory itself is not listed.
+         *  Unfiltered, a directory only tells that it exists.
+         */
+        PathContainerType const& getDirectories() const;
+
+        /**
+         *  Returns the metadata of a listed file, or nullptr.
+         *  The lookup goes by address, so "listedFile" must be the very element of getList().
+         */
+        FileMetadata const* getMetadata(std::string const& listedFile) const;
+
+        /**
+         *  Like getMetadata, but looks the file (relative) up in the list first.
+         */
+        FileMetadata const* findMetadata(std::string const& file) const;
+
+        /**
+         *  Returns whether a file of this scanner differs from its copy in "other" according to the policy.
+         *  Both files must be elements of the respective lists.
+         *
+         *  @param timeWindow Modification times this many nanoseconds apart are equal. File systems keep them in
+         *                    different resolutions, a copy may carry a truncated time.
+         */
+        bool hasChanged(std::string const& file, DirectoryScanner const& other, std::string const& otherFile,
+                        ComparisonPolicy policy, int64_t timeWindow = 0) const;
+
+        /**
+         *  Queues a listed file for hashQueued, unless its hash is known already.
+         *  The hash comparison only uses known hashes, reading whole files is left to hashQueued.
+         */
+        void queueHash(std::string const& listedFile);
+
+        /**
+         *  Hashes queued files, reading at most "byteBudget" bytes. With an executor, one file per thread is read at
+         *  once. A file larger than its share is continued by the next call.
+         *
+         *  @return Returns true, once nothing is queued anymore.
+         */
+        bool hashQueued(uint64_t byteBudget, WorkStealingPool* executor = nullptr);
+
+        /**
+         *  Returns whether the list was loaded from the scan index and is not verified yet.
+         */
+        bool isProvisional() const;
+
+        /**
+         *  Walks the directory again to verify a provisional list, without touching the list in use.
+         *  Can run on another thread than the users of the list, but not on several at once.
+         *
+         *  @return Returns the amount of files scanned.
+         */
+        int rescan(int amount = 8192, WorkStealingPool* executor = nullptr);
+        bool rescanFinished() const;
+
+        /**
+         *  Replaces the provisional list with the result of the finished rescan and writes the index.
+         *  Hashes of files that did not change since the index was written are kept.
+         *  Invalidates everything that refers to the list.
+         */
+        void adoptRescan();
+
+        /**
+         *  Lists a file that was just written into the directory, for instance by a copy.
+         *  Keeps the index, and a rescan that might have passed the file already, up to date.
+         *
+         *  @param verified The copy read the file back and it matched its source.
+         *
+         *  @return Returns false, if the file is not listed, because it is filtered or not a file (anymore).
+         */
+        bool recordFile(std::string const& fileName, bool verified = false);
+
+        /**
+         *  Calls "listener" with the full path of every directory the scan comes across, before its content is read.
+         *  The scanned directory and the directories listed already are passed right away.
+         */
+        void setDirectoryListener(std::function <void(std::string const& directory)> const& listener);
+
+        /**
+         *  Writes the index, if the list changed since it was written last.
+         */
+        void flushIndex();
+
+    private:
+        /**
+         *  A directory that is not completely listed yet.
+         */
+        struct PendingDirectory
+        {
+            std::string path;
+            boost::filesystem::directory_iterator position; // valid once opened.
+            bool opened;
+        };
+
+        /**
+         *  What one job found in one directory, merged into the lists afterwards.
+         */
+        struct Listing
+        {
+            std::vector <std::pair <std::string /* relative */, FileMetadata>> files;
+            std::vector <std::pair <std::string /* relative */, bool /* descend */>> directories;
+            int entries = 0;
+            bool done = false;
+        };
+
+        /**
+         *  Lists up to "quota" entries of a directory. Only touches its arguments, so jobs can run in parallel.
+         */
+        void listDirectory(PendingDirectory& directory, int quota, Listing& listing) const;
+
+        /**
+         *  A queued file, that is not completely hashed yet.
+         */
+        struct PendingHash
+        {
+            std::string const* file; // element of the list
+            uint64_t size; // as scanned, sizes the buffer.
+            NativeFile input; // valid once opened.
+            ContentHash hash;
+            uint64_t offset;
+            bool opened;
+            bool failed;
+            bool done;
+        };
+
+        /**
+         *  Hashes up to "quota" bytes of a file. Only touches its argument, so jobs can run in parallel.
+         *
+         *  @return Returns the amount of bytes read.
+         */
+        uint64_t hashFile(PendingHash& pending, uint64_t quota) const;
+
+        bool isFiltered(std::string const& relativeFile);
+        void loadIndex();
+        void saveIndex();
+        boost::optional <uint64_t> getHash(std::string const& listedFile) const;
+
     private:
         std::string sourceDirectory_;
-        boost::filesystem::recursive_directory_iterator scannerIterator_;
+        std::deque <PendingDirectory> pendingDirectories_; // front to back, new ones are appended.
         ClonerOptions options_;
         bool filtered_;
-        mutable int differenceProgress_;
+        /** Archive bit filtering position in the union of every difference, -1 when done. **/
+        mutable std::map <SymmetricDifferenceExtractor <PathContainerType::iterator> const*, int> differenceProgress_;
         uint64_t filesScanned_;
 
         PathContainerType list_;
-        PathContainerType sievedList_;
+        PathContainerType directories_;
+        mutable ScanIndex::MetadataContainerType metadata_; // hashes are filled in when needed.
+
+        std::string indexFile_; // empty, if there is no index.
+        mutable bool indexDirty_; // the list or its metadata changed since the index was written.
+        std::unique_ptr <DirectoryScanner> rescan_; // verifies a list loaded from the index.
+        std::function <void(std::string const& directory)> directoryListener_;
+        std::deque <PendingHash> pendingHashes_;
+        std::unordered_set <std::string const*> hashesQueued_; // the files of pendingHashes_.
     };
 }
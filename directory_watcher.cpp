@@ -0,0 +1,173 @@
+#include "directory_watcher.hpp"
+#include "log.hpp"
+
+#include <boost/filesystem.hpp>
+
+#ifdef __linux__
+#   include <sys/inotify.h>
+#   include <poll.h>
+#   include <unistd.h>
+#endif
+
+#include <cerrno>
+#include <cstring>
+#include <thread>
+
+namespace FileSpreader
+{
+//#####################################################################################################################
+    namespace fs = boost::filesystem;
+    using namespace std::string_literals;
+//#####################################################################################################################
+#ifdef __linux__
+    namespace
+    {
+        // written and closed, renamed into place, and new directories. Files are only of interest once closed.
+        // Symbolic links are not followed, like the scan does not.
+        constexpr uint32_t watchMask = IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_ONLYDIR | IN_DONT_FOLLOW | IN_EXCL_UNLINK;
+    }
+#endif
+//#####################################################################################################################
+    DirectoryWatcher::DirectoryWatcher()
+        : descriptor_{-1}
+        , good_{false}
+        , watches_{}
+    {
+#ifdef __linux__
+        descriptor_ = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        good_ = descriptor_ != -1;
+        if (!good_)
+            Log(LogSeverity::Warning, "Cannot watch for changes: "s + std::strerror(errno), LOG_CODE_PLACE);
+#endif
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    DirectoryWatcher::~DirectoryWatcher()
+    {
+#ifdef __linux__
+        if (descriptor_ != -1)
+            ::close(descriptor_);
+#endif
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    bool DirectoryWatcher::good() const
+    {
+        return good_;
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    bool DirectoryWatcher::watch(std::string const& directory)
+    {
+#ifdef __linux__
+        if (!good_)
+            return false;
+
+        int watch = ::inotify_add_watch(descriptor_, directory.c_str(), watchMask);
+        if (watch == -1)
+        {
+            // vanished in the meantime, nothing to watch.
+            if (errno == ENOENT || errno == ENOTDIR)
+                return true;
+
+            Log(LogSeverity::Warning, "Cannot watch " + directory + ": " + std::strerror(errno), LOG_CODE_PLACE);
+            good_ = false;
+            return false;
+        }
+
+        // a directory that was moved keeps its watch, but has a new path now.
+        watches_[watch] = directory;
+        return true;
+#else
+        (void)directory;
+        return false;
+#endif
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    DirectoryWatcher::Changes DirectoryWatcher::poll()
+    {
+        Changes changes;
+#ifdef __linux__
+        if (descriptor_ == -1)
+            return changes;
+
+        alignas(struct inotify_event) char buffer[64 * 1024];
+        for (;;)
+        {
+            auto length = ::read(descriptor_, buffer, sizeof(buffer));
+            if (length <= 0)
+                break;
+
+            for (char const* position = buffer; position < buffer + length; )
+            {
+                auto const* event = reinterpret_cast <struct inotify_event const*> (position);
+                position += sizeof(struct inotify_event) + event->len;
+
+                if (event->mask & IN_Q_OVERFLOW)
+                {
+                    changes.overflow = true;
+                    continue;
+                }
+
+                if (event->mask & IN_IGNORED)
+                {
+                    watches_.erase(event->wd);
+                    continue;
+                }
+
+                auto directory = watches_.find(event->wd);
+                if (directory == std::end(watches_) || event->len == 0)
+                    continue;
+
+                auto path = (fs::path(directory->second) / event->name).string();
+                if (event->mask & IN_ISDIR)
+                {
+                    // whatever was put into it before the watch was set, is found by listing it.
+                    if (event->mask & (IN_CREATE | IN_MOVED_TO))
+                        watchTree(path, changes.files);
+                }
+                else if (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO))
+                    changes.files.insert(path);
+            }
+        }
+#endif
+        return changes;
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    void DirectoryWatcher::watchTree(std::string const& directory, std::set <std::string>& files)
+    {
+        // watch first, then list. A file written in between shows up twice, not never.
+        if (!watch(directory))
+            return;
+
+        boost::system::error_code ec;
+        for (fs::directory_iterator i{directory, ec}, end; !ec && i != end; i.increment(ec))
+        {
+            auto status = i->symlink_status(ec);
+            if (ec)
+                break;
+
+            if (fs::is_directory(status))
+                watchTree(i->path().string(), files);
+            else if (fs::is_regular_file(status))
+                files.insert(i->path().string());
+        }
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    void DirectoryWatcher::wait(std::vector <DirectoryWatcher const*> const& watchers, std::chrono::milliseconds timeout)
+    {
+#ifdef __linux__
+        std::vector <struct pollfd> descriptors;
+        for (auto const* i : watchers)
+            if (i->good())
+                descriptors.push_back({i->descriptor_, POLLIN, 0});
+
+        if (!descriptors.empty())
+        {
+            ::poll(descriptors.data(), descriptors.size(), static_cast <int> (timeout.count()));
+            return;
+        }
+#else
+        (void)watchers;
+#endif
+        std::this_thread::sleep_for(timeout);
+    }
+//#####################################################################################################################
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <chrono>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace FileSpreader
+{
+    /**
+     *  Watches a directory tree for files that were written or moved into it, based on linux inotify.
+     *  Every directory has a watch of its own. They are added with watch(), as a scan comes across them,
+     *  so nothing is missed between the scan of a directory and its watch. Directories that are created or moved
+     *  into the tree later are watched and listed by poll() itself.
+     *  The watcher is not thread safe. On other systems (or if the kernel refuses) good() returns false.
+     */
+    class DirectoryWatcher
+    {
+    public:
+        struct Changes
+        {
+            std::set <std::string> files; // absolute paths of written files, and of files in new directories.
+            bool overflow = false; // the kernel dropped events, only a scan of the whole tree can tell what changed.
+        };
+
+    public:
+        DirectoryWatcher();
+        ~DirectoryWatcher();
+
+        DirectoryWatcher(DirectoryWatcher const&) = delete;
+        DirectoryWatcher& operator=(DirectoryWatcher const&) = delete;
+
+        /**
+         *  Returns false, if the watcher could not be set up or a directory could not be watched.
+         *  Changes might go unnoticed then.
+         */
+        bool good() const;
+
+        /**
+         *  Watches a single directory, not its subdirectories. Watching a directory twice does no harm.
+         *  Fails at the watch limit of the system (fs.inotify.max_user_watches).
+         */
+        bool watch(std::string const& directory);
+
+        /**
+         *  Collects the changes that arrived since the last poll, without waiting.
+         */
+        Changes poll();
+
+        /**
+         *  Waits until one of the watchers has changes, or for the timeout. Watchers that are not good are ignored.
+         *  Sleeps for the timeout, if there is nothing to wait for.
+         */
+        static void wait(std::vector <DirectoryWatcher const*> const& watchers, std::chrono::milliseconds timeout);
+
+    private:
+        void watchTree(std::string const& directory, std::set <std::string>& files);
+
+    private:
+        int descriptor_;
+        bool good_;
+        std::map <int /* watch */, std::string /* directory */> watches_;
+    };
+}
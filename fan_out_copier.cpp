@@ -0,0 +1,138 @@
+#include "fan_out_copier.hpp"
+#include "log.hpp"
+
+#include <algorithm>
+
+namespace FileSpreader
+{
+//#####################################################################################################################
+    FanOutCopier::FanOutCopier(std::string const& source, std::vector <std::shared_ptr <Copier>> const& sinks,
+                               std::shared_ptr <BufferPool> bufferPool, uint64_t chunkSize, std::size_t maxQueuedChunks)
+        : source_(source, FileOpenMode::Read)
+        , bufferPool_(std::move(bufferPool))
+        , sinks_()
+        , readBytes_(0)
+        , totalFileSize_(0)
+        , chunkSize_(chunkSize)
+        , maxQueuedChunks_(std::max <std::size_t> (maxQueuedChunks, 1))
+    {
+        if (!source_.good())
+            return;
+
+        totalFileSize_ = source_.size();
+
+        // sinks that do not fit (file changed in between opens, already progressed...) are left on their own.
+        // A clone shares the extents of the source, that beats any read. Only the others are fed.
+        for (auto const& i : sinks)
+        {
+            if (!i || i->tryCloneNow() || !i->isGood() || i->getProgress() != 0 || i->getProgressMax() != totalFileSize_)
+                continue;
+
+            i->setFedExternally(true);
+            sinks_.push_back(Sink{i, {}});
+        }
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    FanOutCopier::~FanOutCopier()
+    {
+        detachAll();
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    bool FanOutCopier::isDone() const
+    {
+        return sinks_.empty();
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    void FanOutCopier::detach(Sink& sink)
+    {
+        // the queued chunks are dropped, the sink rereads them. That is cheaper than having everyone wait.
+        sink.queue.clear();
+        sink.copier->setFedExternally(false);
+        Log(LogSeverity::Debug, "Detached slow destination from shared read: " + sink.copier->getDestinationFile() + ".");
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    void FanOutCopier::detachAll()
+    {
+        for (auto& i : sinks_)
+            detach(i);
+        sinks_.clear();
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    void FanOutCopier::readChunk()
+    {
+        auto count = std::min(chunkSize_, totalFileSize_ - readBytes_);
+        auto chunk = std::make_shared <Chunk> (Chunk{bufferPool_->acquire(count), 0});
+        if (!chunk->buffer)
+            return; // out of buffer memory, the sinks wait for the next pulse.
+
+        auto read = source_.read(chunk->buffer.data(), chunk->buffer.size());
+        if (read <= 0)
+        {
+            // let every copier find out for itself what is wrong with the source.
+            detachAll();
+            return;
+        }
+
+        chunk->size = read;
+        readBytes_ += read;
+
+        for (auto& i : sinks_)
+            i.queue.push_back(chunk);
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    void FanOutCopier::copyChunk(WorkStealingPool* executor)
+    {
+        std::vector <WorkStealingPool::JobType> writes;
+        for (auto& i : sinks_)
+        {
+            if (i.queue.empty())
+                continue;
+
+            auto* sink = &i;
+            writes.push_back([sink]() {
+                auto chunk = sink->queue.front();
+                sink->queue.pop_front();
+                sink->copier->writeChunk(chunk->buffer.data(), chunk->size);
+            });
+        }
+
+        if (executor != nullptr)
+            executor->run(writes);
+        else
+            for (auto const& i : writes)
+                i();
+
+        // finished and broken sinks are no longer fed, the cloner takes care of them.
+        // A complete sink that still verifies is pulsed by the cloner from now on.
+        for (auto& i : sinks_)
+            if (i.copier->isGood() && i.copier->getProgress() == i.copier->getProgressMax())
+                i.copier->setFedExternally(false);
+
+        sinks_.erase(
+            std::remove_if(std::begin(sinks_), std::end(sinks_), [](Sink const& sink) {
+                return !sink.copier->isFedExternally() || !sink.copier->isGood();
+            }),
+            std::end(sinks_)
+        );
+
+        if (sinks_.empty() || readBytes_ == totalFileSize_)
+            return;
+
+        bool starving = std::any_of(std::begin(sinks_), std::end(sinks_), [](Sink const& sink) {
+            return sink.queue.empty();
+        });
+        if (!starving)
+            return;
+
+        // a sink with a full queue would stall all others.
+        auto slowBegin = std::partition(std::begin(sinks_), std::end(sinks_), [this](Sink const& sink) {
+            return sink.queue.size() < maxQueuedChunks_;
+        });
+        for (auto i = slowBegin; i != std::end(sinks_); ++i)
+            detach(*i);
+        sinks_.erase(slowBegin, std::end(sinks_));
+
+        readChunk();
+    }
+//#####################################################################################################################
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "copier.hpp"
+#include "native_file.hpp"
+#include "buffer_pool.hpp"
+#include "work_stealing_pool.hpp"
+
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+namespace FileSpreader
+{
+    /**
+     *  Reads a source file once and feeds every chunk to several Copiers (one per destination).
+     *  Every sink has a bounded queue. A sink that has a full queue while another one starves is detached
+     *  and continues on its own, so a slow destination does not hold the others back.
+     */
+    class FanOutCopier
+    {
+    public:
+        /**
+         *  @param bufferPool The queued chunks are taken from here. A source that cannot get a buffer waits.
+         */
+        FanOutCopier(std::string const& source, std::vector <std::shared_ptr <Copier>> const& sinks,
+                     std::shared_ptr <BufferPool> bufferPool,
+                     uint64_t chunkSize = 1 * 1024 * 1024 /* 1 MB */, std::size_t maxQueuedChunks = 8);
+        ~FanOutCopier();
+
+        FanOutCopier(FanOutCopier const&) = delete;
+        FanOutCopier& operator=(FanOutCopier const&) = delete;
+
+        /**
+         *  Writes a chunk to every attached sink and reads a new one, if a sink needs more data.
+         *  If an executor is given, the sinks are written in parallel.
+         */
+        void copyChunk(WorkStealingPool* executor = nullptr);
+
+        /**
+         *  Returns true if no sink is fed by this anymore.
+         */
+        bool isDone() const;
+
+        /**
+         *  Detaches all sinks. They continue reading from the source by themselves.
+         */
+        void detachAll();
+
+    private:
+        struct Chunk
+        {
+            BufferPool::Buffer buffer;
+            uint64_t size;
+        };
+        using ChunkType = std::shared_ptr <Chunk>;
+
+        struct Sink
+        {
+            std::shared_ptr <Copier> copier;
+            std::deque <ChunkType> queue;
+        };
+
+        void detach(Sink& sink);
+        void readChunk();
+
+    private:
+        NativeFile source_;
+        std::shared_ptr <BufferPool> bufferPool_;
+        std::vector <Sink> sinks_; // attached sinks only.
+        uint64_t readBytes_;
+        uint64_t totalFileSize_;
+        uint64_t chunkSize_;
+        std::size_t maxQueuedChunks_;
+    };
+}
@@ -0,0 +1,266 @@
+#include "io_ring.hpp"
+
+#ifdef DSYNC_HAS_IO_URING
+#   include <linux/io_uring.h>
+#   include <sys/mman.h>
+#   include <sys/syscall.h>
+#   include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <vector>
+
+namespace FileSpreader
+{
+//#####################################################################################################################
+#ifdef DSYNC_HAS_IO_URING
+    namespace
+    {
+        int ioUringSetup(unsigned int entries, io_uring_params* params)
+        {
+            return static_cast <int> (::syscall(__NR_io_uring_setup, entries, params));
+        }
+        int ioUringEnter(int fd, unsigned int toSubmit, unsigned int minComplete, unsigned int flags)
+        {
+            return static_cast <int> (::syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, nullptr, 0));
+        }
+        /**
+         *  Plain reads and writes came with linux 5.6, a ring of an older kernel fails every one of them.
+         *  The probe came with the same version, so a kernel that cannot be probed cannot read either.
+         */
+        bool supportsReadWrite(int fd)
+        {
+            constexpr unsigned int opCount = 256;
+            std::vector <char> memory(sizeof(io_uring_probe) + opCount * sizeof(io_uring_probe_op), 0);
+            auto* probe = reinterpret_cast <io_uring_probe*> (memory.data());
+            if (::syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, opCount) < 0)
+                return false;
+
+            auto supported = [probe](unsigned int opcode) {
+                return opcode <= probe->last_op && (probe->ops[opcode].flags & IO_URING_OP_SUPPORTED);
+            };
+            return supported(IORING_OP_READ) && supported(IORING_OP_WRITE);
+        }
+        template <typename T>
+        T* ringPointer(void* base, uint32_t offset)
+        {
+            return reinterpret_cast <T*> (static_cast <char*> (base) + offset);
+        }
+    }
+#endif
+//#####################################################################################################################
+    IoRing::IoRing(unsigned int entries)
+        : ringFd_{-1}
+        , inFlight_{0}
+        , toSubmit_{0}
+        , capacity_{0}
+        , sqRing_{nullptr}
+        , cqRing_{nullptr}
+        , sqes_{nullptr}
+        , sqRingSize_{0}
+        , cqRingSize_{0}
+        , sqesSize_{0}
+        , sqHead_{nullptr}
+        , sqTail_{nullptr}
+        , sqMask_{nullptr}
+        , sqEntries_{nullptr}
+        , sqArray_{nullptr}
+        , cqHead_{nullptr}
+        , cqTail_{nullptr}
+        , cqMask_{nullptr}
+        , cqes_{nullptr}
+    {
+#ifdef DSYNC_HAS_IO_URING
+        io_uring_params params;
+        std::memset(&params, 0, sizeof(params));
+
+        ringFd_ = ioUringSetup(entries, &params);
+        if (ringFd_ < 0)
+            return;
+
+        if (!supportsReadWrite(ringFd_))
+        {
+            release();
+            return;
+        }
+
+        sqRingSize_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cqRingSize_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        sqesSize_ = params.sq_entries * sizeof(io_uring_sqe);
+
+        bool singleMap = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (singleMap)
+            sqRingSize_ = cqRingSize_ = std::max(sqRingSize_, cqRingSize_);
+
+        auto map = [this](std::size_t size, off_t offset) -> void* {
+            auto* result = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd_, offset);
+            return result == MAP_FAILED ? nullptr : result;
+        };
+
+        sqRing_ = map(sqRingSize_, IORING_OFF_SQ_RING);
+        cqRing_ = singleMap ? sqRing_ : map(cqRingSize_, IORING_OFF_CQ_RING);
+        sqes_ = map(sqesSize_, IORING_OFF_SQES);
+
+        if (sqRing_ == nullptr || cqRing_ == nullptr || sqes_ == nullptr)
+        {
+            release();
+            return;
+        }
+
+        sqHead_ = ringPointer <unsigned> (sqRing_, params.sq_off.head);
+        sqTail_ = ringPointer <unsigned> (sqRing_, params.sq_off.tail);
+        sqMask_ = ringPointer <unsigned> (sqRing_, params.sq_off.ring_mask);
+        sqEntries_ = ringPointer <unsigned> (sqRing_, params.sq_off.ring_entries);
+        sqArray_ = ringPointer <unsigned> (sqRing_, params.sq_off.array);
+        cqHead_ = ringPointer <unsigned> (cqRing_, params.cq_off.head);
+        cqTail_ = ringPointer <unsigned> (cqRing_, params.cq_off.tail);
+        cqMask_ = ringPointer <unsigned> (cqRing_, params.cq_off.ring_mask);
+        cqes_ = ringPointer <void> (cqRing_, params.cq_off.cqes);
+
+        // never have more in flight than the completion queue can hold, it would overflow otherwise.
+        capacity_ = params.cq_entries;
+#else
+        (void)entries;
+#endif
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    IoRing::~IoRing()
+    {
+        release();
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    void IoRing::release()
+    {
+#ifdef DSYNC_HAS_IO_URING
+        if (sqes_ != nullptr)
+            ::munmap(sqes_, sqesSize_);
+        if (cqRing_ != nullptr && cqRing_ != sqRing_)
+            ::munmap(cqRing_, cqRingSize_);
+        if (sqRing_ != nullptr)
+            ::munmap(sqRing_, sqRingSize_);
+        if (ringFd_ >= 0)
+            ::close(ringFd_);
+
+        sqes_ = cqRing_ = sqRing_ = nullptr;
+        ringFd_ = -1;
+#endif
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    bool IoRing::good() const
+    {
+        return ringFd_ >= 0;
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    std::size_t IoRing::getInFlight() const
+    {
+        return inFlight_;
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    bool IoRing::queueRead(int fd, char* buffer, uint32_t size, uint64_t offset, IoRequest* request)
+    {
+#ifdef DSYNC_HAS_IO_URING
+        return queue(IORING_OP_READ, fd, buffer, size, offset, request);
+#else
+        return queue(0, fd, buffer, size, offset, request);
+#endif
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    bool IoRing::queueWrite(int fd, char const* buffer, uint32_t size, uint64_t offset, IoRequest* request)
+    {
+#ifdef DSYNC_HAS_IO_URING
+        return queue(IORING_OP_WRITE, fd, buffer, size, offset, request);
+#else
+        return queue(0, fd, buffer, size, offset, request);
+#endif
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    bool IoRing::queue(uint8_t opcode, int fd, void const* buffer, uint32_t size, uint64_t offset, IoRequest* request)
+    {
+#ifdef DSYNC_HAS_IO_URING
+        if (!good() || inFlight_ >= capacity_)
+            return false;
+
+        auto tail = *sqTail_;
+        if (tail - __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE) == *sqEntries_)
+        {
+            // submission queue is full, hand it to the kernel to make room.
+            if (!submit(false) || tail - __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE) == *sqEntries_)
+                return false;
+        }
+
+        auto index = tail & *sqMask_;
+        auto* sqe = static_cast <io_uring_sqe*> (sqes_) + index;
+        std::memset(sqe, 0, sizeof(io_uring_sqe));
+        sqe->opcode = opcode;
+        sqe->fd = fd;
+        sqe->addr = reinterpret_cast <uint64_t> (buffer);
+        sqe->len = size;
+        sqe->off = offset;
+        sqe->user_data = reinterpret_cast <uint64_t> (request);
+
+        sqArray_[index] = index;
+        __atomic_store_n(sqTail_, tail + 1, __ATOMIC_RELEASE);
+
+        ++toSubmit_;
+        ++inFlight_;
+        return true;
+#else
+        (void)opcode; (void)fd; (void)buffer; (void)size; (void)offset; (void)request;
+        return false;
+#endif
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    bool IoRing::submit(bool wait)
+    {
+#ifdef DSYNC_HAS_IO_URING
+        if (toSubmit_ == 0 && !wait)
+            return true;
+
+        auto result = ioUringEnter(ringFd_, toSubmit_, wait ? 1 : 0, wait ? IORING_ENTER_GETEVENTS : 0);
+        if (result < 0)
+            return errno == EINTR || errno == EAGAIN || errno == EBUSY;
+
+        toSubmit_ -= std::min <unsigned int> (toSubmit_, result);
+        return true;
+#else
+        (void)wait;
+        return false;
+#endif
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    std::size_t IoRing::pump(bool wait)
+    {
+#ifdef DSYNC_HAS_IO_URING
+        if (!good())
+            return 0;
+
+        submit(wait && inFlight_ > 0);
+
+        std::size_t dispatched = 0;
+        auto head = *cqHead_;
+        while (head != __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE))
+        {
+            auto const* cqe = static_cast <io_uring_cqe const*> (cqes_) + (head & *cqMask_);
+            auto* request = reinterpret_cast <IoRequest*> (cqe->user_data);
+            auto result = cqe->res;
+
+            // release the entry before the callback, it may queue follow up requests.
+            ++head;
+            __atomic_store_n(cqHead_, head, __ATOMIC_RELEASE);
+            --inFlight_;
+            ++dispatched;
+
+            if (request != nullptr && request->onComplete)
+                request->onComplete(result);
+        }
+
+        return dispatched;
+#else
+        (void)wait;
+        return 0;
+#endif
+    }
+//#####################################################################################################################
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <functional>
+#include <cstdint>
+#include <cstddef>
+
+#if defined(__linux__) && defined(__has_include)
+#   if __has_include(<linux/io_uring.h>)
+#       define DSYNC_HAS_IO_URING 1
+#   endif
+#endif
+
+namespace FileSpreader
+{
+    /**
+     *  A request handed to the IoRing. It must stay alive until its completion was dispatched.
+     */
+    struct IoRequest
+    {
+        /** Called with the amount of transferred bytes, or -errno on failure. **/
+        std::function <void(int32_t result)> onComplete;
+    };
+
+    /**
+     *  An asynchronous I/O queue based on linux io_uring.
+     *  Reads and writes are queued, submitted in batches and their completions dispatched in pump().
+     *  The ring is not thread safe, it must be used by one thread at a time.
+     *  On other systems (or if the kernel refuses or cannot read and write, before 5.6) good() returns false and
+     *  nothing can be queued.
+     */
+    class IoRing
+    {
+    public:
+        explicit IoRing(unsigned int entries = 256);
+        ~IoRing();
+
+        IoRing(IoRing const&) = delete;
+        IoRing& operator=(IoRing const&) = delete;
+
+        /**
+         *  Returns whether the ring was set up successfully.
+         */
+        bool good() const;
+
+        /**
+         *  Queues a positional read / write. Nothing is submitted to the kernel before pump().
+         *
+         *  @return Returns false if the ring is at its capacity. Retry after a pump().
+         */
+        bool queueRead(int fd, char* buffer, uint32_t size, uint64_t offset, IoRequest* request);
+        bool queueWrite(int fd, char const* buffer, uint32_t size, uint64_t offset, IoRequest* request);
+
+        /**
+         *  Submits all queued requests and dispatches all available completions.
+         *
+         *  @param wait Block until at least one request completes, if any is in flight.
+         *  @return Returns the amount of dispatched completions.
+         */
+        std::size_t pump(bool wait = false);
+
+        /**
+         *  Returns the amount of requests, that were queued but did not complete yet.
+         */
+        std::size_t getInFlight() const;
+
+    private:
+        bool queue(uint8_t opcode, int fd, void const* buffer, uint32_t size, uint64_t offset, IoRequest* request);
+        bool submit(bool wait);
+        void release();
+
+    private:
+        int ringFd_;
+        std::size_t inFlight_;
+        unsigned int toSubmit_;
+        unsigned int capacity_;
+
+        // mapped ring memory
+        void* sqRing_;
+        void* cqRing_;
+        void* sqes_;
+        std::size_t sqRingSize_;
+        std::size_t cqRingSize_;
+        std::size_t sqesSize_;
+
+        unsigned* sqHead_;
+        unsigned* sqTail_;
+        unsigned* sqMask_;
+        unsigned* sqEntries_;
+        unsigned* sqArray_;
+        unsigned* cqHead_;
+        unsigned* cqTail_;
+        unsigned* cqMask_;
+        void* cqes_;
+    };
+}
@@ -51,7 +51,7 @@ int WINAPI WinMain (HINSTANCE hThisInstance,
         }
 
         // Controller & Server creation.
-        Controller controller{static_cast <int> (options.scanMax)};
+        Controller controller{static_cast <int> (options.scanMax), options.threads, options.bufferMemoryMb * 1024ull * 1024};
         Server server (&controller, port);
 
         controller.setUpdateInterval(std::chrono::milliseconds(options.refreshIntervalMs));
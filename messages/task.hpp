@@ -32,6 +32,26 @@ namespace FileSpreader { namespace Messages
         std::string source;
         std::vector <Destination> destinations;
         boost::optional <bool> useArchiveBit;
+        boost::optional <bool> fanOut; // read each file once for all destinations.
+        boost::optional <std::size_t> filesPerDestination; // files in flight per destination.
+        boost::optional <std::size_t> largeFilesPerDestination; // additional slots for large files, default 1.
+        boost::optional <bool> asyncIo; // io_uring backend, linux only.
+        boost::optional <std::string> durability; // "none", "close" (sync before rename) or "periodic"
+        boost::optional <uint64_t> syncIntervalMb; // for "periodic" durability
+        boost::optional <bool> adaptiveChunkSize; // default true, otherwise 1 MB chunks.
+        boost::optional <bool> resumable; // default false, continue interrupted copies.
+        boost::optional <bool> reflink; // default true, clone files on copy on write file systems.
+        boost::optional <uint64_t> largeFileThresholdMb; // default 1024, bigger files bypass the page cache. 0 = never.
+        boost::optional <uint64_t> largeLaneThresholdMb; // default 1024, bigger files have their own slots (largeFilesPerDestination). 0 = never.
+        boost::optional <std::size_t> prefetchCount; // default 4, pending files per destination prepared ahead.
+        boost::optional <uint64_t> smallFileThresholdKb; // default 64, smaller files are copied in batches. 0 = never.
+        boost::optional <std::size_t> rangesPerFile; // default 1, parts of a big file copied concurrently.
+        boost::optional <bool> anonymousTempFiles; // default false, unnamed temporary files (linux) for copies that are not resumable.
+        boost::optional <bool> verify; // default false, check every copy against a hash of its source. Reads every copy back from the destination.
+        boost::optional <std::string> comparison; // "path" (default), "time" (size and modification time) or "hash"
+        boost::optional <uint64_t> modifyWindowMs; // for "time", equal within. Default by file system, 2000 on FAT, 1000 on network shares.
+        boost::optional <std::string> indexDirectory; // default none, keeps the scans for a quick start.
+        boost::optional <bool> watch; // default false, copy changes of the source as they happen (linux).
 
         std::vector <std::string> getDestinations() const;
     };
@@ -49,5 +69,7 @@ BOOST_FUSION_ADAPT_STRUCT
 BOOST_FUSION_ADAPT_STRUCT
 (
     FileSpreader::Messages::Task,
-    source, destinations, useArchiveBit
+    source, destinations, useArchiveBit, fanOut, filesPerDestination, asyncIo, durability, syncIntervalMb, adaptiveChunkSize, resumable, reflink,
+    largeFileThresholdMb, prefetchCount, smallFileThresholdKb, largeFilesPerDestination, rangesPerFile,
+    anonymousTempFiles, verify, comparison, indexDirectory, watch, largeLaneThresholdMb, modifyWindowMs
 )
@@ -0,0 +1,572 @@
+#include "native_file.hpp"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#ifdef _WIN32
+#   include <io.h>
+#   include "windows.hpp"
+#else
+#   include <unistd.h>
+#endif
+
+#if defined(__linux__)
+#   include <sys/vfs.h>
+#elif defined(__APPLE__)
+#   include <sys/param.h>
+#   include <sys/mount.h>
+#endif
+
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+
+namespace FileSpreader
+{
+//#####################################################################################################################
+    namespace
+    {
+#ifdef _WIN32
+        int openFile(std::string const& fileName, FileOpenMode mode)
+        {
+            if (mode == FileOpenMode::Read)
+                return ::_open(fileName.c_str(), _O_RDONLY | _O_BINARY);
+            else if (mode == FileOpenMode::Anonymous)
+                return -1;
+            else if (mode == FileOpenMode::Resume)
+                return ::_open(fileName.c_str(), _O_WRONLY | _O_CREAT | _O_BINARY, _S_IREAD | _S_IWRITE);
+            else
+                return ::_open(fileName.c_str(), _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, _S_IREAD | _S_IWRITE);
+        }
+        int64_t readFile(int fd, char* buffer, uint64_t count)
+        {
+            return ::_read(fd, buffer, static_cast <unsigned int> (std::min <uint64_t> (count, 0x7FFFFFFF)));
+        }
+        int64_t writeFile(int fd, char const* buffer, uint64_t count)
+        {
+            return ::_write(fd, buffer, static_cast <unsigned int> (std::min <uint64_t> (count, 0x7FFFFFFF)));
+        }
+        int64_t readFileAt(int fd, char* buffer, uint64_t count, uint64_t offset)
+        {
+            OVERLAPPED position = {};
+            position.Offset = static_cast <DWORD> (offset);
+            position.OffsetHigh = static_cast <DWORD> (offset >> 32);
+
+            DWORD read = 0;
+            auto handle = reinterpret_cast <HANDLE> (::_get_osfhandle(fd));
+            if (!::ReadFile(handle, buffer, static_cast <DWORD> (std::min <uint64_t> (count, 0x7FFFFFFF)), &read, &position))
+                return ::GetLastError() == ERROR_HANDLE_EOF ? 0 : -1;
+            return read;
+        }
+        int64_t writeFileAt(int fd, char const* buffer, uint64_t count, uint64_t offset)
+        {
+            OVERLAPPED position = {};
+            position.Offset = static_cast <DWORD> (offset);
+            position.OffsetHigh = static_cast <DWORD> (offset >> 32);
+
+            DWORD written = 0;
+            auto handle = reinterpret_cast <HANDLE> (::_get_osfhandle(fd));
+            if (!::WriteFile(handle, buffer, static_cast <DWORD> (std::min <uint64_t> (count, 0x7FFFFFFF)), &written, &position))
+                return -1;
+            return written;
+        }
+        void closeFile(int fd)
+        {
+            ::_close(fd);
+        }
+        bool seekFile(int fd, uint64_t offset)
+        {
+            return ::_lseeki64(fd, static_cast <__int64> (offset), SEEK_SET) >= 0;
+        }
+        bool syncFile(int fd)
+        {
+            return ::_commit(fd) == 0;
+        }
+        bool truncateFile(int fd, uint64_t size)
+        {
+            return ::_chsize_s(fd, static_cast <__int64> (size)) == 0;
+        }
+        AllocationResult preallocateFile(int fd, uint64_t size)
+        {
+            FILE_ALLOCATION_INFO info = {};
+            info.AllocationSize.QuadPart = static_cast <LONGLONG> (size);
+
+            auto handle = reinterpret_cast <HANDLE> (::_get_osfhandle(fd));
+            if (::SetFileInformationByHandle(handle, FileAllocationInfo, &info, sizeof(info)))
+                return AllocationResult::Allocated;
+
+            auto error = ::GetLastError();
+            if (error == ERROR_DISK_FULL || error == ERROR_HANDLE_DISK_FULL)
+                return AllocationResult::NoSpace;
+            if (error == ERROR_INVALID_PARAMETER || error == ERROR_NOT_SUPPORTED)
+                return AllocationResult::Unsupported;
+            return AllocationResult::Failed;
+        }
+        uint64_t fileSize(int fd)
+        {
+            struct _stati64 st;
+            if (::_fstati64(fd, &st) != 0)
+                return 0;
+            return st.st_size;
+        }
+        bool fileHasHoles(int fd)
+        {
+            // the holes are not looked for here (findFileData), but the attribute still tells what the file is.
+            BY_HANDLE_FILE_INFORMATION info;
+            auto handle = reinterpret_cast <HANDLE> (::_get_osfhandle(fd));
+            if (!::GetFileInformationByHandle(handle, &info))
+                return false;
+            return (info.dwFileAttributes & FILE_ATTRIBUTE_SPARSE_FILE) != 0;
+        }
+        int64_t fileModificationTime(int fd)
+        {
+            // whole seconds, like the directory scan sees them here.
+            struct _stati64 st;
+            if (::_fstati64(fd, &st) != 0)
+                return -1;
+            return static_cast <int64_t> (st.st_mtime) * 1'000'000'000;
+        }
+        bool setFileModificationTime(int fd, int64_t nanoseconds)
+        {
+            // FILETIME counts 100ns steps since 1601.
+            ULARGE_INTEGER ticks;
+            ticks.QuadPart = static_cast <ULONGLONG> (nanoseconds / 100) + 116444736000000000ULL;
+            FILETIME time;
+            time.dwLowDateTime = ticks.LowPart;
+            time.dwHighDateTime = ticks.HighPart;
+
+            auto handle = reinterpret_cast <HANDLE> (::_get_osfhandle(fd));
+            return ::SetFileTime(handle, nullptr, nullptr, &time) != 0;
+        }
+        bool findFileData(int fd, uint64_t offset, uint64_t& begin, uint64_t& end)
+        {
+            begin = offset;
+            end = fileSize(fd);
+            return begin < end;
+        }
+#else
+        int openFile(std::string const& fileName, FileOpenMode mode)
+        {
+            if (mode == FileOpenMode::Read)
+                return ::open(fileName.c_str(), O_RDONLY | O_CLOEXEC);
+            else if (mode == FileOpenMode::Anonymous)
+            {
+#if defined(__linux__) && defined(O_TMPFILE)
+                return ::open(fileName.c_str(), O_WRONLY | O_TMPFILE | O_CLOEXEC, 0666);
+#else
+                return -1;
+#endif
+            }
+            else if (mode == FileOpenMode::Resume)
+                return ::open(fileName.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0666);
+            else
+                return ::open(fileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+        }
+        int64_t readFile(int fd, char* buffer, uint64_t count)
+        {
+            ssize_t result;
+            do
+                result = ::read(fd, buffer, count);
+            while (result < 0 && errno == EINTR);
+            return result;
+        }
+        int64_t writeFile(int fd, char const* buffer, uint64_t count)
+        {
+            ssize_t result;
+            do
+                result = ::write(fd, buffer, count);
+            while (result < 0 && errno == EINTR);
+            return result;
+        }
+        int64_t readFileAt(int fd, char* buffer, uint64_t count, uint64_t offset)
+        {
+            ssize_t result;
+            do
+                result = ::pread(fd, buffer, count, static_cast <off_t> (offset));
+            while (result < 0 && errno == EINTR);
+            return result;
+        }
+        int64_t writeFileAt(int fd, char const* buffer, uint64_t count, uint64_t offset)
+        {
+            ssize_t result;
+            do
+                result = ::pwrite(fd, buffer, count, static_cast <off_t> (offset));
+            while (result < 0 && errno == EINTR);
+            return result;
+        }
+        void closeFile(int fd)
+        {
+            ::close(fd);
+        }
+        bool seekFile(int fd, uint64_t offset)
+        {
+            return ::lseek(fd, static_cast <off_t> (offset), SEEK_SET) >= 0;
+        }
+        bool syncFile(int fd)
+        {
+#if defined(__linux__)
+            return ::fdatasync(fd) == 0;
+#else
+            return ::fsync(fd) == 0;
+#endif
+        }
+        bool truncateFile(int fd, uint64_t size)
+        {
+            return ::ftruncate(fd, static_cast <off_t> (size)) == 0;
+        }
+        AllocationResult preallocateFile(int fd, uint64_t size)
+        {
+#if defined(__linux__) && defined(FALLOC_FL_KEEP_SIZE)
+            int result;
+            do
+                result = ::fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, static_cast <off_t> (size));
+            while (result != 0 && errno == EINTR);
+
+            if (result == 0)
+                return AllocationResult::Allocated;
+            if (errno == ENOSPC || errno == EDQUOT)
+                return AllocationResult::NoSpace;
+            if (errno == EOPNOTSUPP || errno == ENOSYS)
+                return AllocationResult::Unsupported;
+            return AllocationResult::Failed;
+#else
+            // posix_fallocate would write zeros where the file system cannot reserve, that costs a whole copy.
+            (void)fd;
+            (void)size;
+            return AllocationResult::Unsupported;
+#endif
+        }
+        uint64_t fileSize(int fd)
+        {
+            struct stat st;
+            if (::fstat(fd, &st) != 0)
+                return 0;
+            return st.st_size;
+        }
+        bool fileHasHoles(int fd)
+        {
+            // the allocated blocks do not tell, compressed and deduplicated files occupy less than their size too.
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+            auto size = fileSize(fd);
+            auto position = ::lseek(fd, 0, SEEK_CUR);
+            auto hole = ::lseek(fd, 0, SEEK_HOLE);
+            ::lseek(fd, position, SEEK_SET);
+            return hole >= 0 && static_cast <uint64_t> (hole) < size;
+#else
+            return false;
+#endif
+        }
+        int64_t fileModificationTime(int fd)
+        {
+            struct stat st;
+            if (::fstat(fd, &st) != 0)
+                return -1;
+#   ifdef __APPLE__
+            return static_cast <int64_t> (st.st_mtimespec.tv_sec) * 1'000'000'000 + st.st_mtimespec.tv_nsec;
+#   else
+            return static_cast <int64_t> (st.st_mtim.tv_sec) * 1'000'000'000 + st.st_mtim.tv_nsec;
+#   endif
+        }
+        bool setFileModificationTime(int fd, int64_t nanoseconds)
+        {
+            struct timespec times[2];
+            times[0].tv_sec = 0;
+            times[0].tv_nsec = UTIME_OMIT; // the access time stays.
+            times[1].tv_sec = static_cast <time_t> (nanoseconds / 1'000'000'000);
+            times[1].tv_nsec = static_cast <long> (nanoseconds % 1'000'000'000);
+            return ::futimens(fd, times) == 0;
+        }
+        bool findFileData(int fd, uint64_t offset, uint64_t& begin, uint64_t& end)
+        {
+            auto size = fileSize(fd);
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+            auto position = ::lseek(fd, 0, SEEK_CUR);
+            auto dataBegin = ::lseek(fd, static_cast <off_t> (offset), SEEK_DATA);
+            if (dataBegin < 0)
+            {
+                auto error = errno;
+                ::lseek(fd, position, SEEK_SET);
+                if (error == ENXIO) // nothing but a hole up to the end.
+                    return false;
+
+                // no support in this file system, treat it as dense.
+                begin = offset;
+                end = size;
+                return begin < end;
+            }
+            auto dataEnd = ::lseek(fd, dataBegin, SEEK_HOLE);
+            ::lseek(fd, position, SEEK_SET);
+
+            begin = static_cast <uint64_t> (dataBegin);
+            end = dataEnd < 0 ? size : static_cast <uint64_t> (dataEnd);
+            return begin < end;
+#else
+            begin = offset;
+            end = size;
+            return begin < end;
+#endif
+        }
+#endif
+    }
+//#####################################################################################################################
+    NativeFile::NativeFile()
+        : fd_{-1}
+    {
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    NativeFile::NativeFile(std::string const& fileName, FileOpenMode mode)
+        : fd_{openFile(fileName, mode)}
+    {
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    NativeFile::~NativeFile()
+    {
+        close();
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    NativeFile::NativeFile(NativeFile&& other)
+        : fd_{other.fd_}
+    {
+        other.fd_ = -1;
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    NativeFile& NativeFile::operator=(NativeFile&& other)
+    {
+        if (this != &other)
+        {
+            close();
+            fd_ = other.fd_;
+            other.fd_ = -1;
+        }
+        return *this;
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    bool NativeFile::good() const
+    {
+        return fd_ >= 0;
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    int NativeFile::descriptor() const
+    {
+        return fd_;
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    uint64_t NativeFile::size() const
+    {
+        if (!good())
+            return 0;
+        return fileSize(fd_);
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    bool NativeFile::hasHoles() const
+    {
+        if (!good())
+            return false;
+        return fileHasHoles(fd_);
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    int64_t NativeFile::modificationTime() const
+    {
+        if (!good())
+            return -1;
+        return fileModificationTime(fd_);
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    bool NativeFile::setModificationTime(int64_t nanoseconds)
+    {
+        if (!good() || nanoseconds < 0)
+            return false;
+        return setFileModificationTime(fd_, nanoseconds);
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    bool NativeFile::findData(uint64_t offset, uint64_t& begin, uint64_t& end) const
+    {
+        if (!good())
+            return false;
+        return findFileData(fd_, offset, begin, end);
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    int64_t NativeFile::read(char* buffer, uint64_t count)
+    {
+        if (!good())
+            return -1;
+        return readFile(fd_, buffer, count);
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    bool NativeFile::write(char const* buffer, uint64_t count)
+    {
+        if (!good())
+            return false;
+
+        while (count > 0)
+        {
+            auto written = writeFile(fd_, buffer, count);
+            if (written <= 0)
+                return false;
+
+            buffer += written;
+            count -= written;
+        }
+        return true;
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    int64_t NativeFile::readAt(char* buffer, uint64_t count, uint64_t offset)
+    {
+        if (!good())
+            return -1;
+        return readFileAt(fd_, buffer, count, offset);
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    bool NativeFile::writeAt(char const* buffer, uint64_t count, uint64_t offset)
+    {
+        if (!good())
+            return false;
+
+        while (count > 0)
+        {
+            auto written = writeFileAt(fd_, buffer, count, offset);
+            if (written <= 0)
+                return false;
+
+            buffer += written;
+            count -= written;
+            offset += written;
+        }
+        return true;
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    bool NativeFile::seek(uint64_t offset)
+    {
+        if (!good())
+            return false;
+        return seekFile(fd_, offset);
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    bool NativeFile::truncate(uint64_t size)
+    {
+        if (!good())
+            return false;
+        return truncateFile(fd_, size);
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    AllocationResult NativeFile::preallocate(uint64_t size)
+    {
+        if (!good())
+            return AllocationResult::Failed;
+        if (size == 0)
+            return AllocationResult::Allocated;
+        return preallocateFile(fd_, size);
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    bool NativeFile::link(std::string const& fileName)
+    {
+        if (!good())
+            return false;
+#if defined(__linux__)
+        // linking the descriptor itself (AT_EMPTY_PATH) needs privileges, the /proc path does not.
+        auto path = "/proc/self/fd/" + std::to_string(fd_);
+        return ::linkat(AT_FDCWD, path.c_str(), AT_FDCWD, fileName.c_str(), AT_SYMLINK_FOLLOW) == 0;
+#else
+        (void)fileName;
+        return false;
+#endif
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    bool NativeFile::sync()
+    {
+        if (!good())
+            return false;
+        return syncFile(fd_);
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    bool NativeFile::syncDirectory(std::string const& directory)
+    {
+#ifdef _WIN32
+        (void)directory;
+        return true;
+#else
+        int fd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd < 0)
+            return false;
+
+        bool result = ::fsync(fd) == 0;
+        ::close(fd);
+        return result;
+#endif
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    void NativeFile::prefetch(std::string const& fileName, uint64_t bytes)
+    {
+        NativeFile file(fileName, FileOpenMode::Read);
+#ifdef __linux__
+        if (file.good())
+            ::posix_fadvise(file.descriptor(), 0, static_cast <off_t> (bytes), POSIX_FADV_WILLNEED);
+#else
+        (void)bytes;
+#endif
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    int64_t NativeFile::modificationTimeWindow(std::string const& directory)
+    {
+        int64_t const fat = 2'000'000'000;
+        int64_t const seconds = 1'000'000'000;
+        int64_t const fine = 1'000;
+
+#if defined(_WIN32)
+        char volume[MAX_PATH + 1] = {};
+        char fileSystem[MAX_PATH + 1] = {};
+        if (!::GetVolumePathNameA(directory.c_str(), volume, sizeof(volume)) ||
+            !::GetVolumeInformationA(volume, nullptr, 0, nullptr, nullptr, nullptr, fileSystem, sizeof(fileSystem)))
+        {
+            return seconds; // unknown, the scan sees whole seconds here anyway.
+        }
+        if (std::strncmp(fileSystem, "FAT", 3) == 0 || std::strcmp(fileSystem, "exFAT") == 0)
+            return fat;
+        return fine;
+#elif defined(__linux__)
+        struct statfs st;
+        if (::statfs(directory.c_str(), &st) != 0)
+            return seconds;
+
+        switch (static_cast <uint64_t> (st.f_type))
+        {
+        case 0x4d44: // msdos
+        case 0x2011bab0: // exfat
+        case 0x65735546: // fuse, exfat and ntfs among others
+            return fat;
+        case 0x482b: // hfs+
+        case 0x6969: // nfs
+        case 0xff534d42: // cifs
+        case 0xfe534d42: // smb2
+        case 0x517b: // smb
+            return seconds;
+        default:
+            return fine;
+        }
+#elif defined(__APPLE__)
+        struct statfs st;
+        if (::statfs(directory.c_str(), &st) != 0)
+            return seconds;
+
+        if (std::strcmp(st.f_fstypename, "msdos") == 0 || std::strcmp(st.f_fstypename, "exfat") == 0)
+            return fat;
+        if (std::strcmp(st.f_fstypename, "apfs") == 0)
+            return fine;
+        return seconds; // hfs and the network file systems.
+#else
+        (void)directory;
+        return seconds;
+#endif
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    void NativeFile::close()
+    {
+        if (fd_ >= 0)
+        {
+            closeFile(fd_);
+            fd_ = -1;
+        }
+    }
+//#####################################################################################################################
+}
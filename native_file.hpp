@@ -0,0 +1,152 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+
+namespace FileSpreader
+{
+    enum class FileOpenMode
+    {
+        Read,
+        Write, // creates or truncates
+        Resume, // writes, creates but does not truncate
+        Anonymous // writes an unnamed file in the given directory (O_TMPFILE), linux only. See NativeFile::link.
+    };
+
+    enum class AllocationResult
+    {
+        Allocated,
+        NoSpace, // the file system is too full.
+        Unsupported, // by the system or the file system, nothing was reserved.
+        Failed
+    };
+
+    /**
+     *  A thin RAII wrapper around an operating system file descriptor.
+     *  The copy engine needs the raw descriptor for kernel side transfers, which the standard streams do not expose.
+     */
+    class NativeFile
+    {
+    public:
+        NativeFile();
+        NativeFile(std::string const& fileName, FileOpenMode mode);
+        ~NativeFile();
+
+        NativeFile(NativeFile&& other);
+        NativeFile& operator=(NativeFile&& other);
+        NativeFile(NativeFile const&) = delete;
+        NativeFile& operator=(NativeFile const&) = delete;
+
+        /**
+         *  Returns whether the file is open.
+         */
+        bool good() const;
+
+        /**
+         *  Returns the underlying descriptor, or -1 if the file is not open.
+         */
+        int descriptor() const;
+
+        /**
+         *  Returns the size of the file in bytes.
+         */
+        uint64_t size() const;
+
+        /**
+         *  Returns whether the file is sparse: A hole before its end (SEEK_HOLE), the sparse attribute on windows.
+         *  Compressed or deduplicated files that merely occupy less than their size are not.
+         */
+        bool hasHoles() const;
+
+        /**
+         *  The time of the last modification in nanoseconds since the epoch, -1 on error.
+         *  In the resolution the directory scan sees, whole seconds on windows.
+         */
+        int64_t modificationTime() const;
+        bool setModificationTime(int64_t nanoseconds);
+
+        /**
+         *  Finds the first data extent at or after "offset" (SEEK_DATA / SEEK_HOLE). The file offset is kept.
+         *  Where holes are not supported, everything from "offset" to the end is data.
+         *
+         *  @return Returns false if there is no data after "offset".
+         */
+        bool findData(uint64_t offset, uint64_t& begin, uint64_t& end) const;
+
+        /**
+         *  Reads up to "count" bytes.
+         *
+         *  @return Returns the amount of bytes read, 0 on end of file and -1 on error.
+         */
+        int64_t read(char* buffer, uint64_t count);
+
+        /**
+         *  Writes all "count" bytes, retrying on partial writes.
+         *
+         *  @return Returns false on error.
+         */
+        bool write(char const* buffer, uint64_t count);
+
+        /**
+         *  Positional read / write (pread / pwrite), several threads may use them on the same file at once.
+         *  They do not use the file offset. On linux they do not move it either, on windows it is left behind the
+         *  bytes transferred (ReadFile / WriteFile with an OVERLAPPED position), seek before reading or writing
+         *  sequentially again.
+         *  readAt returns like read, writeAt like write.
+         */
+        int64_t readAt(char* buffer, uint64_t count, uint64_t offset);
+        bool writeAt(char const* buffer, uint64_t count, uint64_t offset);
+
+        /**
+         *  Moves the file offset to an absolute position.
+         */
+        bool seek(uint64_t offset);
+
+        /**
+         *  Cuts off or extends the file to the given size.
+         */
+        bool truncate(uint64_t size);
+
+        /**
+         *  Reserves disk space for the first "size" bytes of the file, without changing its size (fallocate with
+         *  FALLOC_FL_KEEP_SIZE, the allocation size on Windows). Writing into reserved space cannot run out of it
+         *  and the file system can lay the file out in one go.
+         */
+        AllocationResult preallocate(uint64_t size);
+
+        /**
+         *  Gives a file opened with FileOpenMode::Anonymous a name. Does not replace an existing file.
+         *  Must be called before the file is closed, an unnamed file is gone after that.
+         */
+        bool link(std::string const& fileName);
+
+        /**
+         *  Flushes written data to the storage device (fdatasync / _commit).
+         */
+        bool sync();
+
+        /**
+         *  Flushes a directory entry change (like a rename) to the storage device.
+         *  A no-op on systems that do not support opening directories.
+         */
+        static bool syncDirectory(std::string const& directory);
+
+        /**
+         *  Opens a file and asks the system to read its first "bytes" into the cache in the background
+         *  (POSIX_FADV_WILLNEED). Where there is no such hint, only the open (and its metadata lookup) is done ahead.
+         */
+        static void prefetch(std::string const& fileName, uint64_t bytes);
+
+        /**
+         *  Returns the nanoseconds two modification times may differ by on the file system of the directory and still
+         *  be the same: 2 s on FAT and exFAT, 1 s on HFS+ and network file systems, 1 µs elsewhere (NTFS has 100 ns).
+         *  A time set on a file is truncated to what its file system keeps.
+         */
+        static int64_t modificationTimeWindow(std::string const& directory);
+
+        void close();
+
+    private:
+        int fd_;
+    };
+}
@@ -53,6 +53,8 @@ namespace FileSpreader
             ("tasks,t", po::value <std::string>(&vars_.persistence), "a persistence file, with saved tasks")
             ("interval,i", po::value <unsigned int>(&vars_.refreshIntervalMs), "The refresh interval in milliseconds, must be larger than 100ms.")
             ("scanFileMax,m", po::value <unsigned int>(&vars_.scanMax), "Maximum files to be scanned each round")
+            ("threads,j", po::value <unsigned int>(&vars_.threads), "Amount of threads copying in parallel, 0 = one per hardware thread")
+            ("bufferMemory,b", po::value <unsigned int>(&vars_.bufferMemoryMb), "Maximum memory of all copy buffers in MB")
         ;
 
         std::vector <char const*> prox;
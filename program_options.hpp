@@ -20,6 +20,8 @@ namespace FileSpreader
         std::string persistence = "";
         unsigned int refreshIntervalMs = 10000;
         unsigned int scanMax = 8192;
+        unsigned int threads = 0; // 0 = one per hardware thread
+        unsigned int bufferMemoryMb = 256;
     };
 
     class ProgramOptions
@@ -16,16 +16,23 @@
 
 namespace FileSpreader
 {
+    struct FileProgress : public JSON::Stringifiable <FileProgress>
+                        , public JSON::Parsable <FileProgress>
+                        , public SXML::Xmlifiable <FileProgress>
+    {
+        std::string file;
+        double progress;
+    };
+
     struct DestinationProgress : public JSON::Stringifiable <DestinationProgress>
                                , public JSON::Parsable <DestinationProgress>
                                , public SXML::Xmlifiable <DestinationProgress>
     {
         std::string destination;
-        std::string currentFile;
+        std::vector <FileProgress> currentFiles;
         std::vector <std::string> remainingFiles;
         uint64_t remainingFileCount;
         uint64_t scanFileCount;
-        double currentFileProgress;
     };
 
     struct SourceGroupProgress : public JSON::Stringifiable <SourceGroupProgress>
@@ -42,13 +49,21 @@ namespace FileSpreader
     {
         uint64_t totalRemainingBytes;
         uint64_t totalRemainingFiles;
+        uint64_t bufferMemoryUsed; // held by the copy buffer pool, idle buffers included.
+        uint64_t bufferMemoryLimit;
         std::vector <SourceGroupProgress> sources;
     };
 }
+BOOST_FUSION_ADAPT_STRUCT
+(
+    FileSpreader::FileProgress,
+    file, progress
+)
+
 BOOST_FUSION_ADAPT_STRUCT
 (
     FileSpreader::DestinationProgress,
-    destination, currentFile, remainingFiles, currentFileProgress, remainingFileCount, scanFileCount
+    destination, currentFiles, remainingFiles, remainingFileCount, scanFileCount
 )
 
 BOOST_FUSION_ADAPT_STRUCT
@@ -60,5 +75,5 @@ BOOST_FUSION_ADAPT_STRUCT
 BOOST_FUSION_ADAPT_STRUCT
 (
     FileSpreader::ProgressReport,
-    totalRemainingBytes, totalRemainingFiles, sources
+    totalRemainingBytes, totalRemainingFiles, bufferMemoryUsed, bufferMemoryLimit, sources
 )
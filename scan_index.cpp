@@ -0,0 +1,381 @@
+#include "scan_index.hpp"
+#include "content_hash.hpp"
+#include "native_file.hpp"
+#include "log.hpp"
+
+#include <boost/filesystem.hpp>
+
+#ifdef _WIN32
+#   include "windows.hpp"
+#else
+#   include <fcntl.h>
+#   include <sys/mman.h>
+#   include <sys/stat.h>
+#   include <unistd.h>
+#endif
+
+#include <cstring>
+#include <vector>
+
+namespace FileSpreader
+{
+//#####################################################################################################################
+    namespace fs = boost::filesystem;
+//#####################################################################################################################
+    namespace
+    {
+        constexpr char indexMagic[8] = {'D', 'S', 'I', 'N', 'D', 'E', 'X', '\0'};
+        constexpr uint32_t indexVersion = 2;
+
+        // FileRecord::flags
+        constexpr uint32_t fileHashed = 1u << 0;
+        constexpr uint32_t fileVerified = 1u << 1;
+
+        struct IndexHeader
+        {
+            char magic[8];
+            uint32_t version; // also tells the byte order.
+            uint32_t recordSize;
+            uint64_t fileCount;
+            uint64_t directoryCount;
+            uint64_t stringsSize;
+            uint64_t directoryLength; // the scanned directory, first of the strings.
+            uint64_t checksum; // of everything after the header.
+        };
+
+        struct FileRecord
+        {
+            uint64_t size;
+            int64_t modified;
+            uint64_t inode;
+            uint64_t hash;
+            uint64_t pathOffset; // into the strings
+            uint32_t pathLength;
+            uint32_t flags;
+        };
+
+        struct DirectoryRecord
+        {
+            uint64_t pathOffset;
+            uint64_t pathLength;
+        };
+
+        /**
+         *  Streams the index into a file through a buffer and hashes it on the way.
+         */
+        class IndexWriter
+        {
+        public:
+            explicit IndexWriter(std::string const& fileName)
+                : file_{fileName, FileOpenMode::Write}
+                , hash_{}
+                , buffer_{}
+                , good_{file_.good()}
+            {
+                buffer_.reserve(bufferSize);
+
+                // the header is only known at the end, leave room for it.
+                IndexHeader header{};
+                good_ = good_ && file_.write(reinterpret_cast <char const*> (&header), sizeof(header));
+            }
+
+            void append(void const* data, uint64_t size)
+            {
+                auto const* bytes = static_cast <char const*> (data);
+                hash_.update(bytes, size);
+                buffer_.insert(std::end(buffer_), bytes, bytes + size);
+                if (buffer_.size() >= bufferSize)
+                    flush();
+            }
+
+            bool finish(IndexHeader& header)
+            {
+                flush();
+                header.checksum = hash_.digest();
+                good_ = good_ && file_.writeAt(reinterpret_cast <char const*> (&header), sizeof(header), 0);
+                good_ = good_ && file_.sync();
+                file_.close();
+                return good_;
+            }
+
+        private:
+            void flush()
+            {
+                good_ = good_ && file_.write(buffer_.data(), buffer_.size());
+                buffer_.clear();
+            }
+
+        private:
+            static constexpr std::size_t bufferSize = 1024 * 1024;
+
+            NativeFile file_;
+            ContentHash hash_;
+            std::vector <char> buffer_;
+            bool good_;
+        };
+
+        template <typename T>
+        T readRecord(char const* data)
+        {
+            T record;
+            std::memcpy(&record, data, sizeof(T));
+            return record;
+        }
+    }
+//#####################################################################################################################
+    ScanIndex::ScanIndex()
+        : data_{nullptr}
+        , size_{0}
+        , strings_{0}
+        , fileCount_{0}
+        , directoryCount_{0}
+    {
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    ScanIndex::~ScanIndex()
+    {
+        close();
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    bool ScanIndex::open(std::string const& fileName, std::string const& directory)
+    {
+        close();
+
+#ifdef _WIN32
+        auto file = ::CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                                  FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+            return false;
+
+        LARGE_INTEGER fileSize;
+        if (!::GetFileSizeEx(file, &fileSize) || fileSize.QuadPart < static_cast <LONGLONG> (sizeof(IndexHeader)))
+        {
+            ::CloseHandle(file);
+            return false;
+        }
+
+        // the view keeps the mapping alive, neither handle is needed past this.
+        auto mapping = ::CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        ::CloseHandle(file);
+        if (mapping == nullptr)
+            return false;
+
+        auto* view = ::MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        ::CloseHandle(mapping);
+        if (view == nullptr)
+            return false;
+
+        data_ = static_cast <char const*> (view);
+        size_ = static_cast <uint64_t> (fileSize.QuadPart);
+#else
+        int descriptor = ::open(fileName.c_str(), O_RDONLY | O_CLOEXEC);
+        if (descriptor == -1)
+            return false;
+
+        struct stat st;
+        if (::fstat(descriptor, &st) != 0 || st.st_size < static_cast <off_t> (sizeof(IndexHeader)))
+        {
+            ::close(descriptor);
+            return false;
+        }
+
+        auto* view = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+        ::close(descriptor);
+        if (view == MAP_FAILED)
+            return false;
+
+        // read front to back exactly once, while the lists are built.
+        ::madvise(view, st.st_size, MADV_SEQUENTIAL);
+
+        data_ = static_cast <char const*> (view);
+        size_ = static_cast <uint64_t> (st.st_size);
+#endif
+
+        auto header = readRecord <IndexHeader> (data_);
+        auto const recordsSize = header.fileCount * sizeof(FileRecord) + header.directoryCount * sizeof(DirectoryRecord);
+        if (std::memcmp(header.magic, indexMagic, sizeof(indexMagic)) != 0 ||
+            header.version != indexVersion ||
+            header.recordSize != sizeof(FileRecord) ||
+            header.fileCount > size_ / sizeof(FileRecord) ||
+            header.directoryCount > size_ / sizeof(DirectoryRecord) ||
+            sizeof(IndexHeader) + recordsSize + header.stringsSize != size_ ||
+            header.directoryLength > header.stringsSize)
+        {
+            Log(LogSeverity::Warning, "The scan index " + fileName + " is not readable, it is ignored.");
+            close();
+            return false;
+        }
+
+        fileCount_ = header.fileCount;
+        directoryCount_ = header.directoryCount;
+        strings_ = sizeof(IndexHeader) + recordsSize;
+
+        if (getString(0, header.directoryLength) != directory)
+        {
+            Log(LogSeverity::Warning, "The scan index " + fileName + " belongs to another directory, it is ignored.");
+            close();
+            return false;
+        }
+
+        ContentHash checksum;
+        checksum.update(data_ + sizeof(IndexHeader), size_ - sizeof(IndexHeader));
+        if (checksum.digest() != header.checksum)
+        {
+            Log(LogSeverity::Warning, "The scan index " + fileName + " is damaged, it is ignored.");
+            close();
+            return false;
+        }
+
+        // every path must lie within the strings, so the accessors need no checks.
+        for (uint64_t i = 0; i != fileCount_; ++i)
+        {
+            auto record = readRecord <FileRecord> (data_ + sizeof(IndexHeader) + i * sizeof(FileRecord));
+            if (record.pathOffset > header.stringsSize || record.pathLength > header.stringsSize - record.pathOffset)
+            {
+                close();
+                return false;
+            }
+        }
+        for (uint64_t i = 0; i != directoryCount_; ++i)
+        {
+            auto record = readRecord <DirectoryRecord> (data_ + sizeof(IndexHeader) + fileCount_ * sizeof(FileRecord) + i * sizeof(DirectoryRecord));
+            if (record.pathOffset > header.stringsSize || record.pathLength > header.stringsSize - record.pathOffset)
+            {
+                close();
+                return false;
+            }
+        }
+
+        return true;
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    void ScanIndex::close()
+    {
+        if (data_ != nullptr)
+        {
+#ifdef _WIN32
+            ::UnmapViewOfFile(data_);
+#else
+            ::munmap(const_cast <char*> (data_), size_);
+#endif
+        }
+        data_ = nullptr;
+        size_ = 0;
+        strings_ = 0;
+        fileCount_ = 0;
+        directoryCount_ = 0;
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    uint64_t ScanIndex::getFileCount() const
+    {
+        return fileCount_;
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    std::string ScanIndex::getFile(uint64_t index) const
+    {
+        auto record = readRecord <FileRecord> (data_ + sizeof(IndexHeader) + index * sizeof(FileRecord));
+        return getString(record.pathOffset, record.pathLength);
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    FileMetadata ScanIndex::getMetadata(uint64_t index) const
+    {
+        auto record = readRecord <FileRecord> (data_ + sizeof(IndexHeader) + index * sizeof(FileRecord));
+
+        FileMetadata metadata;
+        metadata.size = record.size;
+        metadata.modified = record.modified;
+        metadata.inode = record.inode;
+        metadata.hash = record.hash;
+        metadata.hashed = (record.flags & fileHashed) != 0;
+        metadata.verified = (record.flags & fileVerified) != 0;
+        return metadata;
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    uint64_t ScanIndex::getDirectoryCount() const
+    {
+        return directoryCount_;
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    std::string ScanIndex::getDirectory(uint64_t index) const
+    {
+        auto record = readRecord <DirectoryRecord> (data_ + sizeof(IndexHeader) + fileCount_ * sizeof(FileRecord) + index * sizeof(DirectoryRecord));
+        return getString(record.pathOffset, record.pathLength);
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    std::string ScanIndex::getString(uint64_t offset, uint64_t length) const
+    {
+        // offsets are relative to the strings, which follow all records.
+        return std::string(data_ + strings_ + offset, length);
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    bool ScanIndex::write(std::string const& fileName, std::string const& directory, PathContainerType const& files,
+                          MetadataContainerType const& metadata, PathContainerType const& directories)
+    {
+        auto const pendingFile = fileName + ".pending";
+
+        IndexHeader header{};
+        std::memcpy(header.magic, indexMagic, sizeof(indexMagic));
+        header.version = indexVersion;
+        header.recordSize = sizeof(FileRecord);
+        header.fileCount = files.size();
+        header.directoryCount = directories.size();
+        header.directoryLength = directory.size();
+
+        {
+            IndexWriter writer(pendingFile);
+
+            // the paths follow all records, in the same order.
+            uint64_t offset = directory.size();
+            for (auto const& i : files)
+            {
+                FileRecord record{};
+                auto entry = metadata.find(&i);
+                if (entry != std::end(metadata))
+                {
+                    record.size = entry->second.size;
+                    record.modified = entry->second.modified;
+                    record.inode = entry->second.inode;
+                    record.hash = entry->second.hash;
+                    record.flags = (entry->second.hashed ? fileHashed : 0) | (entry->second.verified ? fileVerified : 0);
+                }
+                record.pathOffset = offset;
+                record.pathLength = static_cast <uint32_t> (i.size());
+                offset += i.size();
+                writer.append(&record, sizeof(record));
+            }
+            for (auto const& i : directories)
+            {
+                DirectoryRecord record{offset, i.size()};
+                offset += i.size();
+                writer.append(&record, sizeof(record));
+            }
+
+            writer.append(directory.data(), directory.size());
+            for (auto const& i : files)
+                writer.append(i.data(), i.size());
+            for (auto const& i : directories)
+                writer.append(i.data(), i.size());
+
+            header.stringsSize = offset;
+            if (!writer.finish(header))
+            {
+                Log(LogSeverity::Warning, "Cannot write the scan index " + pendingFile + ".", LOG_CODE_PLACE);
+                boost::system::error_code ec;
+                fs::remove(pendingFile, ec);
+                return false;
+            }
+        }
+
+        boost::system::error_code ec;
+        fs::rename(pendingFile, fileName, ec);
+        if (ec)
+        {
+            Log(LogSeverity::Warning, "Cannot replace the scan index " + fileName + ": " + ec.message(), LOG_CODE_PLACE);
+            fs::remove(pendingFile, ec);
+            return false;
+        }
+        NativeFile::syncDirectory(fs::path(fileName).parent_path().string());
+        return true;
+    }
+//#####################################################################################################################
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <cstdint>
+
+namespace FileSpreader
+{
+    /**
+     *  What the scan learned about a file, from the same stat that told it is a file.
+     */
+    struct FileMetadata
+    {
+        uint64_t size = 0;
+        int64_t modified = 0; // nanoseconds since the epoch
+        uint64_t inode = 0; // 0 where the system has none
+        uint64_t hash = 0; // ContentHash of the content, only valid if "hashed".
+        bool hashed = false;
+        bool verified = false; // written by a copy, that read it back and found it equal to its source.
+    };
+
+    /**
+     *  The result of a finished directory scan, persisted in a file, so a restart does not have to wait for a
+     *  scan of the whole tree before it can copy. The file is memory mapped for reading and written aside and renamed
+     *  into place, so a reader never sees a torn index. A checksum covers everything past the header.
+     *
+     *  Layout: header, one record per file, one record per directory, then all paths back to back.
+     *  Integers are stored in the byte order of the writer, an index of another byte order is rejected.
+     */
+    class ScanIndex
+    {
+    public:
+        using PathContainerType = std::set <std::string>;
+        using MetadataContainerType = std::unordered_map <std::string const* /* element of the files */, FileMetadata>;
+
+    public:
+        ScanIndex();
+        ~ScanIndex();
+        ScanIndex(ScanIndex const&) = delete;
+        ScanIndex& operator=(ScanIndex const&) = delete;
+
+        /**
+         *  Maps an index file.
+         *
+         *  @param directory The scanned directory. An index of another directory is rejected.
+         *
+         *  @return Returns false, if there is no index or it is damaged, outdated or of another directory.
+         */
+        bool open(std::string const& fileName, std::string const& directory);
+        void close();
+
+        /**
+         *  The files are sorted like in the scanner's list, directories as well.
+         *  Only valid while the index is open.
+         */
+        uint64_t getFileCount() const;
+        std::string getFile(uint64_t index) const;
+        FileMetadata getMetadata(uint64_t index) const;
+        uint64_t getDirectoryCount() const;
+        std::string getDirectory(uint64_t index) const;
+
+        /**
+         *  Writes an index file next to "fileName", syncs it and renames it over "fileName".
+         *  Files without metadata are stored with empty metadata.
+         */
+        static bool write(std::string const& fileName, std::string const& directory, PathContainerType const& files,
+                          MetadataContainerType const& metadata, PathContainerType const& directories);
+
+    private:
+        std::string getString(uint64_t offset, uint64_t length) const;
+
+    private:
+        char const* data_; // the mapped file, nullptr if closed.
+        uint64_t size_;
+        uint64_t strings_; // offset of the paths in the file.
+        uint64_t fileCount_;
+        uint64_t directoryCount_;
+    };
+}
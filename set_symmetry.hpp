@@ -1,8 +1,16 @@
 #pragma once
 
+#include <functional>
+#include <set>
 #include <thread>
 #include <vector>
 
+/**
+ *  Extracts the difference of two sets incrementally, a given amount of steps at a time.
+ *  Both sets are sorted, so both sides are merged in one linear walk. The sets are not modified,
+ *  but must not change while the extractor works on them.
+ *  Elements on both sides can additionally be told apart by a change predicate (see setChangePredicate).
+ */
 template <typename IteratorT>
 class SymmetricDifferenceExtractor
 {
@@ -10,27 +18,40 @@ public:
     using iterator = IteratorT;
     using container_type = std::vector <typename iterator::value_type>;
     using input_container_type = std::set <typename iterator::value_type>;
+    using change_predicate = std::function <bool(
+        typename iterator::value_type const& lhs,
+        typename iterator::value_type const& rhs
+    )>;
 
 public:
     SymmetricDifferenceExtractor(
         input_container_type* lhsContainer,
         input_container_type* rhsContainer
     )
-        : lhsBegin_{std::begin(*lhsContainer)}
-        , rhsBegin_{std::begin(*rhsContainer)}
-        , lhsProgress_{std::begin(*lhsContainer)}
+        : lhsProgress_{std::begin(*lhsContainer)}
         , rhsProgress_{std::begin(*rhsContainer)}
         , lhsSearcher_{std::begin(*lhsContainer)}
         , rhsSearcher_{std::begin(*rhsContainer)}
         , lhsEnd_{std::end(*lhsContainer)}
         , rhsEnd_{std::end(*rhsContainer)}
+        , less_{lhsContainer->key_comp()}
         , leftDiff_{}
         , rightDiff_{}
-        , lhsContainer_{lhsContainer}
-        , rhsContainer_{rhsContainer}
+        , union_{}
+        , changed_{}
+        , isChanged_{}
     {
     }
 
+    /**
+     *  Elements on both sides, for which the predicate returns true, end up in the changed list
+     *  instead of the union. Called with the left and the right element, only by workLeftOnly.
+     */
+    void setChangePredicate(change_predicate predicate)
+    {
+        isChanged_ = std::move(predicate);
+    }
+
     /**
      *  Returns true if the difference has been extracted.
      */
@@ -45,11 +66,11 @@ public:
     /**
      *  Returns true if the difference has been extracted.
      *  Left Difference = All Elements that are left, but not right.
+     *  Also collects the union (the elements on both sides) and the changed elements.
      */
     bool workLeftOnly(int count)
     {
-        for (int i = 0; i != count && lhsProgress_ != lhsEnd_; ++i)
-            advanceSide(lhsProgress_, rhsSearcher_, leftDiff_, rhsBegin_, rhsEnd_, *lhsContainer_, *rhsContainer_);
+        walk(count, lhsProgress_, rhsSearcher_, lhsEnd_, rhsEnd_, leftDiff_, &union_, &changed_);
 
         return lhsProgress_ == lhsEnd_;
     }
@@ -60,8 +81,7 @@ public:
      */
     bool workRightOnly(int count)
     {
-        for (int i = 0; i != count && rhsProgress_ != rhsEnd_; ++i)
-            advanceSide(rhsProgress_, lhsSearcher_, rightDiff_, lhsBegin_, lhsEnd_, *rhsContainer_, *lhsContainer_);
+        walk(count, rhsProgress_, lhsSearcher_, rhsEnd_, lhsEnd_, rightDiff_, nullptr, nullptr);
 
         return rhsProgress_ == rhsEnd_;
     }
@@ -90,6 +110,10 @@ public:
     {
         return rightDiff_.empty();
     }
+    bool isEmptyChanged() const
+    {
+        return changed_.empty();
+    }
 
     std::size_t leftSize() const
     {
@@ -99,6 +123,10 @@ public:
     {
         return rightDiff_.size();
     }
+    std::size_t changedSize() const
+    {
+        return changed_.size();
+    }
 
     container_type* getLeftDifference()
     {
@@ -112,6 +140,14 @@ public:
     {
         return &union_;
     }
+    container_type* getChanged()
+    {
+        return &changed_;
+    }
+    container_type const& getChanged() const
+    {
+        return changed_;
+    }
     container_type const& getLeftDifference() const
     {
         return leftDiff_;
@@ -122,47 +158,45 @@ public:
     }
 
 private:
-    void advanceSide(
-        iterator& progressIterator,
-        iterator& searchIterator,
+    /**
+     *  Every step moves "progress", "other" or both ahead, so a side is done after at most n + m steps.
+     *  Elements of "progress" that "other" lacks go to "diff", the common ones to "common" or "changed", if given.
+     */
+    void walk(
+        int count,
+        iterator& progress,
+        iterator& other,
+        iterator const& progressEnd,
+        iterator const& otherEnd,
         container_type& diff,
-        iterator& begin,
-        iterator& end,
-        input_container_type& containerOfProgress,
-        input_container_type& otherContainer
+        container_type* common,
+        container_type* changed
     )
     {
-        if (begin == end)
-        {
-            diff.push_back(*progressIterator);
-            ++progressIterator;
-            return;
-        }
-
-        if (*progressIterator != *searchIterator)
-            ++searchIterator;
-        else
+        for (int i = 0; i != count && progress != progressEnd; ++i)
         {
-            union_.push_back(*progressIterator);
-            progressIterator = containerOfProgress.erase(progressIterator);
-            otherContainer.erase(searchIterator);
-            begin = std::begin(otherContainer);
-            searchIterator = begin;
-            return;
-        }
-
-        if (searchIterator == end)
-        {
-            diff.push_back(*progressIterator);
-            progressIterator = containerOfProgress.erase(progressIterator);
-            searchIterator = begin;
+            if (other == otherEnd || less_(*progress, *other))
+            {
+                diff.push_back(*progress);
+                ++progress;
+            }
+            else if (less_(*other, *progress))
+            {
+                ++other;
+            }
+            else
+            {
+                if (changed != nullptr && isChanged_ && isChanged_(*progress, *other))
+                    changed->push_back(*progress);
+                else if (common != nullptr)
+                    common->push_back(*progress);
+                ++progress;
+                ++other;
+            }
         }
     }
 
 private:
-    iterator lhsBegin_;
-    iterator rhsBegin_;
-
     iterator lhsProgress_;
     iterator rhsProgress_;
 
@@ -172,11 +206,12 @@ private:
     iterator lhsEnd_;
     iterator rhsEnd_;
 
+    typename input_container_type::key_compare less_;
+
     container_type leftDiff_; // elements that are left, but not right
     container_type rightDiff_; // elements that are right, but not left
+    container_type union_; // elements that are on both sides
+    container_type changed_; // elements that are on both sides, but differ according to isChanged_
 
-    input_container_type* lhsContainer_;
-    input_container_type* rhsContainer_;
-
-    container_type union_;
+    change_predicate isChanged_;
 };
@@ -0,0 +1,170 @@
+#include "work_stealing_pool.hpp"
+
+#include <algorithm>
+#include <chrono>
+
+namespace FileSpreader
+{
+//#####################################################################################################################
+    namespace
+    {
+        // the pool and queue the current thread is working for, if it is a worker.
+        thread_local void const* workerPool = nullptr;
+        thread_local std::size_t workerQueue = 0;
+    }
+//#####################################################################################################################
+    WorkStealingPool::WorkStealingPool(unsigned int threadCount)
+        : queues_()
+        , workers_()
+        , sleepLock_()
+        , wakeUp_()
+        , queuedJobs_(0)
+        , stopping_(false)
+    {
+        if (threadCount == 0)
+            threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+
+        // the calling thread always helps out, so it counts as one.
+        for (unsigned int i = 0; i != threadCount; ++i)
+            queues_.emplace_back(new Queue);
+
+        for (unsigned int i = 0; i + 1 < threadCount; ++i)
+            workers_.emplace_back(&WorkStealingPool::workerLoop, this, i);
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    WorkStealingPool::~WorkStealingPool()
+    {
+        {
+            std::lock_guard <std::mutex> guard(sleepLock_);
+            stopping_.store(true);
+        }
+        wakeUp_.notify_all();
+
+        for (auto& i : workers_)
+            i.join();
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    unsigned int WorkStealingPool::getThreadCount() const
+    {
+        return static_cast <unsigned int> (queues_.size());
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    std::size_t WorkStealingPool::getOwnQueue() const
+    {
+        if (workerPool == this)
+            return workerQueue;
+        else
+            return queues_.size() - 1; // shared by all threads outside of the pool.
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    bool WorkStealingPool::tryExecuteOne(std::size_t ownQueue)
+    {
+        Job job{nullptr, nullptr};
+
+        // newest own job first (cache friendly), then the oldest of the others.
+        {
+            auto& own = *queues_[ownQueue];
+            std::lock_guard <std::mutex> guard(own.lock);
+            if (!own.jobs.empty())
+            {
+                job = own.jobs.back();
+                own.jobs.pop_back();
+            }
+        }
+        for (std::size_t i = 1; job.work == nullptr && i != queues_.size(); ++i)
+        {
+            auto& victim = *queues_[(ownQueue + i) % queues_.size()];
+            std::lock_guard <std::mutex> guard(victim.lock);
+            if (!victim.jobs.empty())
+            {
+                job = victim.jobs.front();
+                victim.jobs.pop_front();
+            }
+        }
+
+        if (job.work == nullptr)
+            return false;
+
+        --queuedJobs_;
+
+        std::exception_ptr error;
+        try
+        {
+            (*job.work)();
+        }
+        catch (...)
+        {
+            error = std::current_exception();
+        }
+
+        // the batch may be gone as soon as the lock is released with pending == 0.
+        std::lock_guard <std::mutex> guard(job.batch->doneLock);
+        if (error && !job.batch->error)
+            job.batch->error = error;
+        if (--job.batch->pending == 0)
+            job.batch->done.notify_all();
+
+        return true;
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    void WorkStealingPool::workerLoop(std::size_t index)
+    {
+        workerPool = this;
+        workerQueue = index;
+
+        while (!stopping_.load())
+        {
+            if (tryExecuteOne(index))
+                continue;
+
+            std::unique_lock <std::mutex> lock(sleepLock_);
+            wakeUp_.wait(lock, [this]() {
+                return stopping_.load() || queuedJobs_.load() > 0;
+            });
+        }
+    }
+//---------------------------------------------------------------------------------------------------------------------
+    void WorkStealingPool::run(std::vector <JobType> const& jobs)
+    {
+        if (jobs.empty())
+            return;
+
+        Batch batch;
+        batch.pending = jobs.size();
+
+        auto ownQueue = getOwnQueue();
+        {
+            auto& own = *queues_[ownQueue];
+            std::lock_guard <std::mutex> guard(own.lock);
+            for (auto const& i : jobs)
+                own.jobs.push_back(Job{&i, &batch});
+        }
+        {
+            std::lock_guard <std::mutex> guard(sleepLock_);
+            queuedJobs_ += jobs.size();
+        }
+        wakeUp_.notify_all();
+
+        for (;;)
+        {
+            {
+                std::lock_guard <std::mutex> guard(batch.doneLock);
+                if (batch.pending == 0)
+                    break;
+            }
+
+            if (tryExecuteOne(ownQueue))
+                continue;
+
+            // nothing to help with, wait for the others. Wake up regularly, nested jobs might show up.
+            std::unique_lock <std::mutex> lock(batch.doneLock);
+            batch.done.wait_for(lock, std::chrono::milliseconds(1), [&batch]() {
+                return batch.pending == 0;
+            });
+        }
+
+        if (batch.error)
+            std::rethrow_exception(batch.error);
+    }
+//#####################################################################################################################
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace FileSpreader
+{
+    /**
+     *  A fork-join thread pool. Every thread has its own job queue and idle threads steal from the others.
+     *  A thread that waits for its jobs to finish helps executing jobs, so run() may be nested freely.
+     */
+    class WorkStealingPool
+    {
+    public:
+        using JobType = std::function <void()>;
+
+        /**
+         *  @param threadCount The amount of threads that work on jobs, including the one calling run().
+         *                     0 = one per hardware thread.
+         */
+        explicit WorkStealingPool(unsigned int threadCount = 0);
+        ~WorkStealingPool();
+
+        WorkStealingPool(WorkStealingPool const&) = delete;
+        WorkStealingPool& operator=(WorkStealingPool const&) = delete;
+
+        /**
+         *  Runs all jobs in parallel and returns when every one of them is finished.
+         *  The first exception thrown by a job is rethrown here, after all jobs finished.
+         */
+        void run(std::vector <JobType> const& jobs);
+
+        /**
+         *  Returns the amount of threads working on jobs, including the calling thread.
+         */
+        unsigned int getThreadCount() const;
+
+    private:
+        struct Batch
+        {
+            std::size_t pending; // guarded by doneLock
+            std::mutex doneLock;
+            std::condition_variable done;
+            std::exception_ptr error; // guarded by doneLock
+        };
+
+        struct Job
+        {
+            JobType const* work;
+            Batch* batch;
+        };
+
+        struct Queue
+        {
+            std::mutex lock;
+            std::deque <Job> jobs;
+        };
+
+        void workerLoop(std::size_t index);
+        bool tryExecuteOne(std::size_t ownQueue);
+        std::size_t getOwnQueue() const;
+
+    private:
+        std::vector <std::unique_ptr <Queue>> queues_; // one per worker + one for all outside threads.
+        std::vector <std::thread> workers_;
+        std::mutex sleepLock_;
+        std::condition_variable wakeUp_;
+        std::atomic <std::size_t> queuedJobs_;
+        std::atomic_bool stopping_;
+    };
+}